@@ -1,10 +1,13 @@
 #ifndef ACCEL_H_
 #define ACCEL_H_
 
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 #include "core.h"
 #include "ray.h"
+#include "interaction.h"
 
 struct AABB {
     // the minimum and maximum coordinate for the AABB
@@ -25,6 +28,20 @@ struct AABB {
 
     bool intersect(const Ray &ray, float *t_in, float *t_out);
 
+    /// slab test against a precomputed ray, limited to [ray.t_min, t_max].
+    /// the entrance distance is written to t_in on a hit.
+    bool intersect(const TraversalRay &ray, float t_max, float &t_in) const {
+        float tx_min = ((ray.sign[0] ? upper_bnd : low_bnd).x() - ray.origin.x()) * ray.inv_direction.x();
+        float tx_max = ((ray.sign[0] ? low_bnd : upper_bnd).x() - ray.origin.x()) * ray.inv_direction.x();
+        float ty_min = ((ray.sign[1] ? upper_bnd : low_bnd).y() - ray.origin.y()) * ray.inv_direction.y();
+        float ty_max = ((ray.sign[1] ? low_bnd : upper_bnd).y() - ray.origin.y()) * ray.inv_direction.y();
+        float tz_min = ((ray.sign[2] ? upper_bnd : low_bnd).z() - ray.origin.z()) * ray.inv_direction.z();
+        float tz_max = ((ray.sign[2] ? low_bnd : upper_bnd).z() - ray.origin.z()) * ray.inv_direction.z();
+        t_in = std::max(std::max(tx_min, ty_min), std::max(tz_min, ray.t_min));
+        float t_out = std::min(std::min(tx_max, ty_max), std::min(tz_max, t_max));
+        return t_in <= t_out;
+    }
+
     /// Get the AABB center
     [[nodiscard]] Vec3f getCenter() const { return (low_bnd + upper_bnd) / 2; }
 
@@ -33,18 +50,9 @@ struct AABB {
 
     /// Check whether the AABB is overlapping with another AABB
     [[nodiscard]] bool isOverlap(const AABB &other) const;
-};
 
-struct BVHNode {
-    BVHNode *left;
-    BVHNode *right;
-    // bounding box of current node.
-    int right_idx{-1};
-    AABB aabb;
-    // index of triangles in current BVH leaf node.
-//    std::vector<int> triangles;
-    int triangles_begin_idx{};
-    int triangles_end_idx{};
+    /// Get the surface area of the AABB, used by the SAH
+    [[nodiscard]] float getSurfaceArea() const;
 };
 
 struct LBVHNode {
@@ -55,8 +63,132 @@ struct LBVHNode {
         int triangle_end_idx;
     };
 
+    LBVHNode() = default;
+
     LBVHNode(AABB aabb) : aabb(std::move(aabb)){};
 };
-// You may need to add your code for BVH construction here.
+
+/// relative cost of one node visit and one triangle test, used by the SAH builder and cost metric
+constexpr float SAH_TRAVERSAL_COST = 1.0f;
+constexpr float SAH_INTERSECTION_COST = 1.0f;
+/// capacity of the traversal stack, enough for the depth of trees built by the builders below
+constexpr int BVH_STACK_SIZE = 128;
+/// deepest leaf the builders may emit; a binary traversal holds at most one stack entry per level
+constexpr int BVH_MAX_DEPTH = BVH_STACK_SIZE;
+
+/// largest leaf the BVH builders are allowed to create
+constexpr int BVH_MAX_LEAF_SIZE = 8;
+
+/// Build a linear BVH: Morton codes of the primitive centroids are radix sorted in parallel,
+/// the hierarchy is emitted with Karras' parallel construction and bounded bottom-up.
+/// Subtrees of at most BVH_MAX_LEAF_SIZE primitives are collapsed into leaves.
+/// Falls back to buildBinnedSAHBVH if the hierarchy is deeper than BVH_MAX_DEPTH.
+/// Output layout and prim_order are the same as for buildBinnedSAHBVH.
+std::vector<LBVHNode> buildLBVH(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order);
+
+/// Build a BVH over the given primitive bounds with a task-parallel top-down binned SAH builder.
+/// The result uses the flattened LBVHNode layout (left child at idx + 1, inclusive leaf ranges).
+/// Leaf ranges index into prim_order, which receives the primitive permutation.
+/// Ranges below a depth of BVH_MAX_DEPTH - 32 are split at their median, so the depth stays bounded.
+std::vector<LBVHNode> buildBinnedSAHBVH(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order);
+
+/// number of leaves in the treelets restructured by optimizeBVHTreelets
+constexpr int TREELET_SIZE = 7;
+
+/// Restructure treelets of up to TREELET_SIZE leaves into their SAH-optimal topology (TRBVH).
+/// Each iteration is one parallel bottom-up pass; leaf ranges are kept and only the topology changes.
+/// The input is returned unchanged if the restructured tree would be deeper than BVH_MAX_DEPTH.
+std::vector<LBVHNode> optimizeBVHTreelets(const std::vector<LBVHNode> &nodes, int iterations);
+
+/// SAH cost of a flattened BVH, normalized by the surface area of the root.
+float computeSAHCost(const std::vector<LBVHNode> &nodes);
+
+/// number of edges from the root to the deepest leaf of a flattened BVH
+int computeBVHDepth(const std::vector<LBVHNode> &nodes);
+
+/// Whether a flattened BVH read from a file can be traversed safely over prim_count primitives:
+/// leaf ranges lie within them, children come after their parent and the depth is at most BVH_MAX_DEPTH.
+bool isValidBVH(const std::vector<LBVHNode> &nodes, int prim_count);
+
+/// Ordered closest-hit traversal of a flattened binary BVH. leaf_test(begin, end, hit) tests the
+/// inclusive primitive range and returns whether hit was updated; hit.t bounds the search on entry.
+template<typename LeafTest>
+bool intersectBVH(const std::vector<LBVHNode> &nodes, const TraversalRay &ray, HitRecord &hit, LeafTest &&leaf_test) {
+    struct StackEntry {
+        int idx;
+        float t_in;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    float t_in;
+    if (nodes.empty() || !nodes[0].aabb.intersect(ray, hit.t, t_in)) return false;
+    bool found = false;
+    int idx = 0;
+    while (true) {
+        const LBVHNode &node = nodes[idx];
+        if (node.triangle_begin_idx != -1) {
+            found |= leaf_test(node.triangle_begin_idx, node.triangle_end_idx, hit);
+        } else {
+            // descend into the nearer child and defer the farther one
+            int left = idx + 1, right = node.right_idx;
+            float t_left, t_right;
+            bool hit_left = nodes[left].aabb.intersect(ray, hit.t, t_left);
+            bool hit_right = nodes[right].aabb.intersect(ray, hit.t, t_right);
+            if (hit_left && hit_right) {
+                if (t_right < t_left) {
+                    std::swap(left, right);
+                    std::swap(t_left, t_right);
+                }
+                stack[stack_size++] = {right, t_right};
+                idx = left;
+                continue;
+            } else if (hit_left || hit_right) {
+                idx = hit_left ? left : right;
+                continue;
+            }
+        }
+        // pop the next node that may still hold a closer hit
+        do {
+            if (stack_size == 0) return found;
+            --stack_size;
+        } while (stack[stack_size].t_in > hit.t);
+        idx = stack[stack_size].idx;
+    }
+}
+
+/// any-hit traversal of a flattened binary BVH, stops at the first leaf for which leaf_test(begin, end)
+/// returns true
+template<typename LeafTest>
+bool occludedBVH(const std::vector<LBVHNode> &nodes, const TraversalRay &ray, LeafTest &&leaf_test) {
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    float t_in;
+    if (nodes.empty() || !nodes[0].aabb.intersect(ray, ray.t_max, t_in)) return false;
+    int idx = 0;
+    while (true) {
+        const LBVHNode &node = nodes[idx];
+        if (node.triangle_begin_idx != -1) {
+            if (leaf_test(node.triangle_begin_idx, node.triangle_end_idx)) return true;
+        } else {
+            // any hit ends the query, so the children are not ordered by distance
+            int left = idx + 1, right = node.right_idx;
+            bool hit_left = nodes[left].aabb.intersect(ray, ray.t_max, t_in);
+            bool hit_right = nodes[right].aabb.intersect(ray, ray.t_max, t_in);
+            if (hit_left && hit_right) {
+                stack[stack_size++] = right;
+                idx = left;
+                continue;
+            } else if (hit_left || hit_right) {
+                idx = hit_left ? left : right;
+                continue;
+            }
+        }
+        if (stack_size == 0) return false;
+        idx = stack[--stack_size];
+    }
+}
+
+/// stable parallel LSD radix sort of (key, value) pairs by the lowest key_bits bits of the key
+void radixSortPairs(std::vector<unsigned int> &keys, std::vector<int> &values, int key_bits = 32);
 
 #endif //ACCEL_H_
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef BINARY_IO_H_
+#define BINARY_IO_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Values are stored as their bytes in memory, so files only move between builds of the same layout.
+// Fixed-size Eigen types count as plain data: they are not trivially copyable by the trait, but they
+// hold nothing but their coefficients.
+template<typename T>
+constexpr bool IS_PLAIN_DATA = std::is_trivially_destructible_v<T> && !std::is_pointer_v<T>;
+
+// arrays start on this boundary, so they can be used in place from a mapping of the file
+constexpr size_t BINARY_ARRAY_ALIGNMENT = 64;
+
+/// Read-only view of a whole file, memory mapped where the platform allows it
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string &path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /// false when the file could not be opened or mapped
+    [[nodiscard]] bool isOpen() const { return opened; }
+
+    [[nodiscard]] const char *getData() const { return data; }
+
+    [[nodiscard]] size_t getSize() const { return size; }
+
+private:
+    const char *data{nullptr};
+    size_t size{0};
+    bool opened{false};
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+/// writes values and arrays of plain data in sequence
+class BinaryWriter {
+public:
+    explicit BinaryWriter(const std::string &path) : file(path, std::ios::binary) {}
+
+    [[nodiscard]] bool good() const { return file.good(); }
+
+    /// bytes written so far
+    [[nodiscard]] size_t getSize() const { return offset; }
+
+    template<typename T>
+    void write(const T &value) {
+        static_assert(IS_PLAIN_DATA<T>);
+        writeBytes(&value, sizeof(T));
+    }
+
+    /// the element count, then the elements from the next aligned offset
+    template<typename T>
+    void writeArray(const std::vector<T> &array) {
+        static_assert(IS_PLAIN_DATA<T>);
+        write<uint64_t>(array.size());
+        while (offset % BINARY_ARRAY_ALIGNMENT != 0) writeBytes("", 1);
+        writeBytes(array.data(), array.size() * sizeof(T));
+    }
+
+private:
+    void writeBytes(const void *bytes, size_t count) {
+        file.write(static_cast<const char *>(bytes), (std::streamsize) count);
+        offset += count;
+    }
+
+    std::ofstream file;
+    size_t offset{0};
+};
+
+/// Reads what BinaryWriter wrote from memory. Reads past the end fail, and every read after a
+/// failed one fails too, so a whole sequence can be checked once at its end.
+class BinaryReader {
+public:
+    BinaryReader(const char *data, size_t size) : data(data), size(size) {}
+
+    [[nodiscard]] bool good() const { return !failed; }
+
+    template<typename T>
+    bool read(T &value) {
+        static_assert(IS_PLAIN_DATA<T>);
+        return readBytes(&value, sizeof(T));
+    }
+
+    template<typename T>
+    bool readArray(std::vector<T> &array) {
+        static_assert(IS_PLAIN_DATA<T>);
+        uint64_t count;
+        if (!read(count)) return false;
+        offset = (offset + BINARY_ARRAY_ALIGNMENT - 1) / BINARY_ARRAY_ALIGNMENT * BINARY_ARRAY_ALIGNMENT;
+        if (offset > size || count > (size - offset) / sizeof(T)) {
+            failed = true;
+            return false;
+        }
+        array.resize(count);
+        return readBytes(array.data(), count * sizeof(T));
+    }
+
+private:
+    bool readBytes(void *bytes, size_t count) {
+        if (failed || offset > size || count > size - offset) {
+            failed = true;
+            return false;
+        }
+        if (count > 0) std::memcpy(bytes, data + offset, count);
+        offset += count;
+        return true;
+    }
+
+    const char *data;
+    size_t size;
+    size_t offset{0};
+    bool failed{false};
+};
+
+#endif //BINARY_IO_H_
@@ -3,49 +3,109 @@
 
 #include "interaction.h"
 
-class BSDF {
+#include <utility>
+#include <variant>
+
+// The material types below are held by value in BSDF, which dispatches to them without virtual calls.
+// interaction.wo is the direction of the incoming ray, interaction.wi points away from the surface.
+
+class IdealDiffusion {
 public:
-    BSDF() = default;
+    explicit IdealDiffusion(Vec3f color);
 
-    virtual ~BSDF() = default;
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
 
-    [[nodiscard]] virtual Vec3f evaluate(Interaction &interaction) const = 0;
+    /// solid angle density with which sample() picks interaction.wi (world space)
+    float pdf(Interaction &interaction) const;
 
-    virtual float pdf(Interaction &interaction) const = 0;
+    /// sample interaction.wi and return its pdf
+    float sample(Interaction &interaction, Sampler &sampler) const;
 
-    virtual float sample(Interaction &interaction, Sampler &sampler) const = 0;
+    [[nodiscard]] bool isDelta() const { return false; }
 
-    [[nodiscard]] virtual bool isDelta() const = 0;
+private:
+    Vec3f color;
 };
 
-class IdealDiffusion : public BSDF {
+class IdealSpecular {
 public:
-    explicit IdealDiffusion(Vec3f color);
+    IdealSpecular() = default;
 
-    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const override;
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
 
-    float pdf(Interaction &interaction) const override;
+    float pdf(Interaction &interaction) const;
 
-    float sample(Interaction &interaction, Sampler &sampler) const override;
+    float sample(Interaction &interaction, Sampler &sampler) const;
 
-    [[nodiscard]] bool isDelta() const override;
+    [[nodiscard]] bool isDelta() const { return true; }
+};
+
+/// normalized Phong lobe around the mirror direction, higher exponents are shinier
+class Glossy {
+public:
+    Glossy(Vec3f color, float exponent);
+
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
+
+    float pdf(Interaction &interaction) const;
+
+    /// samples below the surface are returned with pdf 0
+    float sample(Interaction &interaction, Sampler &sampler) const;
+
+    [[nodiscard]] bool isDelta() const { return false; }
 
 private:
     Vec3f color;
+    float exponent;
 };
 
-class IdealSpecular : public BSDF {
+/// smooth glass, reflects or refracts with the probability given by the Fresnel equations.
+/// the side is told by the normal, which points out of the object.
+class Dielectric {
 public:
-    IdealSpecular() = default;
-    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const override;
+    Dielectric(Vec3f color, float ior);
+
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
 
-    float pdf(Interaction &interaction) const override;
+    float pdf(Interaction &interaction) const;
 
-    float sample(Interaction &interaction, Sampler &sampler) const override;
+    float sample(Interaction &interaction, Sampler &sampler) const;
 
-    [[nodiscard]] bool isDelta() const override;
+    [[nodiscard]] bool isDelta() const { return true; }
+
+private:
+    Vec3f color;
+    float ior;
 };
 
-// You can add your own bsdf here
+// You can add your own bsdf here, then to the variant of BSDF
+
+/// A material of the scene, one of a closed set of types. Calls are dispatched on the type index
+/// within bsdf.cpp, where the code of every type can be inlined.
+class BSDF {
+public:
+    using Variant = std::variant<IdealDiffusion, IdealSpecular, Glossy, Dielectric>;
+
+    static constexpr int TYPE_COUNT = (int) std::variant_size_v<Variant>;
+
+    template<typename T>
+    BSDF(T bsdf) : bsdf(std::move(bsdf)) {}
+
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
+
+    /// solid angle density with which sample() picks interaction.wi (world space)
+    float pdf(Interaction &interaction) const;
+
+    /// sample interaction.wi and return its pdf
+    float sample(Interaction &interaction, Sampler &sampler) const;
+
+    [[nodiscard]] bool isDelta() const;
+
+    /// index of the material type in Variant, hits can be shaded in batches of one type
+    [[nodiscard]] int getType() const { return (int) bsdf.index(); }
+
+private:
+    Variant bsdf;
+};
 
 #endif //BSDF_H_
@@ -8,7 +8,23 @@
 #include <map>
 
 enum class MaterialType {
-    DIFFUSE, SPECULAR
+    DIFFUSE, SPECULAR, GLOSSY, DIELECTRIC
+};
+
+enum class IntegratorType {
+    PATH, WAVEFRONT
+};
+
+enum class BVHBuilderType {
+    LBVH, BINNED_SAH
+};
+
+enum class SamplerType {
+    INDEPENDENT, SOBOL, HALTON
+};
+
+enum class TileOrder {
+    SCANLINE, MORTON, HILBERT
 };
 
 struct Config {
@@ -30,24 +46,103 @@ struct Config {
         float color[3];
         MaterialType type;
         std::string name;
+        // radiance emitted by the front of triangles with this material, nonzero turns every one of
+        // them into an area light. paths end on emitters like on square lights.
+        float emission[3]{0, 0, 0};
+        // Phong exponent of glossy materials
+        float exponent{32};
+        // index of refraction of dielectric materials, color tints what passes
+        float ior{1.5f};
+    };
+
+    struct TransformConfig {
+        float translate[3]{0, 0, 0};
+        // rotation in degrees about the x, y and z axes, applied in that order
+        float rotate[3]{0, 0, 0};
+        float scale[3]{1, 1, 1};
     };
 
     struct ObjConfig {
         std::string obj_file_path;
         std::string material_name;
-        float translate[3];
-        float scale;
-        bool has_bvh;
+        float translate[3]{0, 0, 0};
+        float scale{1};
+        // places of copies of the object, each applied after translate and scale. empty places the
+        // object once. all objects of one obj file share its geometry and BVH.
+        std::vector<TransformConfig> instances;
+    };
+
+    struct EnvironmentConfig {
+        // equirectangular HDR image around the scene, empty for none. rays that escape see it.
+        std::string hdr_file_path;
+        // multiplies the radiance of the image
+        float scale{1};
+    };
+
+    struct AccelConfig {
+        BVHBuilderType builder{BVHBuilderType::LBVH};
+        // number of treelet restructuring passes run after the build, 0 disables it
+        int optimize_iterations{0};
+        // branching factor of the traversed BVH: 2 (binary LBVH), 4 (SSE) or 8 (AVX)
+        int width{2};
+        // store wide nodes with 8-bit child bounds relative to the node, only for width 4 and 8
+        bool compressed{false};
+        // directory of binary scene caches, empty disables them. a scene whose objects, obj files and
+        // builder settings are unchanged is loaded from its cache instead of being built again.
+        std::string cache_dir;
+    };
+
+    struct RenderConfig {
+        // trace camera rays in 8x8 packets, packets with mixed direction signs fall back to single rays
+        bool packet_tracing{false};
+        // path: one path at a time per thread, wavefront: bounce by bounce over queues of paths.
+        // wavefront renders all samples in one pass without tiles, packets or Russian roulette, so it
+        // ignores packet_tracing, tile_*, pass_spp, time_budget, preview_interval, target_error,
+        // max_spp and russian_roulette_depth
+        IntegratorType integrator{IntegratorType::PATH};
+        // number of paths in flight per wave of the wavefront integrator
+        int wavefront_size{1 << 18};
+        // sort the secondary rays of each wave by direction octant and origin Morton code before tracing
+        bool sort_rays{false};
+        // shade the hits of each wave grouped by material type, a batch runs the code of one BSDF
+        bool group_materials{false};
+        // edge length in pixels of the tiles handed to threads, rounded up to whole ray packets
+        int tile_size{16};
+        // order in which tiles are handed out, space filling curves keep concurrent tiles close
+        TileOrder tile_order{TileOrder::MORTON};
+        // number of render threads, 0 keeps the OpenMP default
+        int threads{0};
+        // samples per pixel of each progressive pass, 0 renders all samples in a single pass unless a
+        // time budget or previews are set, which split the render into 16 passes
+        int pass_spp{0};
+        // wall-clock budget in seconds, checked after every pass, 0 for none
+        float time_budget{0};
+        // seconds between preview images written after a pass, 0 for none
+        float preview_interval{0};
+        // adaptive sampling keeps sampling pixels whose standard error in the gamma corrected output
+        // (0 to 1) is above this, 0 disables it
+        float target_error{0};
+        // upper bound on the samples per pixel of adaptive sampling, spp is the base every pixel gets
+        int max_spp{0};
+        // bounces after which paths are terminated by Russian roulette on their throughput, 0 disables it
+        int russian_roulette_depth{0};
+        // random numbers of the path tracer: independent, sobol (Owen scrambled) or halton (scrambled)
+        SamplerType sampler{SamplerType::INDEPENDENT};
+        // hashed into every sample, renders of different frames get independent noise
+        int frame{0};
     };
 
-    //   RenderConfig render_config;
+    RenderConfig render_config;
     int spp;
     int max_depth;
     int image_resolution[2];
     CamConfig cam_config;
-    LightConfig light_config;
+    // square area lights, a single "light_config" is read as one more
+    std::vector<LightConfig> lights;
+    EnvironmentConfig environment;
     std::vector<MaterialConfig> materials;
     std::vector<ObjConfig> objects;
+    AccelConfig accel_config;
 };
 
 #endif // CONFIG_H
\ No newline at end of file
@@ -13,20 +13,115 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::CamConfig, position, look_at, ref_up,
 // add your own bsdf name if needed
 NLOHMANN_JSON_SERIALIZE_ENUM(MaterialType, {
     { MaterialType::DIFFUSE, "diffuse" },
-    { MaterialType::SPECULAR, "specular" }
+    { MaterialType::SPECULAR, "specular" },
+    { MaterialType::GLOSSY, "glossy" },
+    { MaterialType::DIELECTRIC, "dielectric" }
 });
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::MaterialConfig, color, type, name);
+NLOHMANN_JSON_SERIALIZE_ENUM(IntegratorType, {
+    { IntegratorType::PATH, "path" },
+    { IntegratorType::WAVEFRONT, "wavefront" }
+});
+
+NLOHMANN_JSON_SERIALIZE_ENUM(BVHBuilderType, {
+    { BVHBuilderType::LBVH, "lbvh" },
+    { BVHBuilderType::BINNED_SAH, "sah" }
+});
+
+NLOHMANN_JSON_SERIALIZE_ENUM(SamplerType, {
+    { SamplerType::INDEPENDENT, "independent" },
+    { SamplerType::SOBOL, "sobol" },
+    { SamplerType::HALTON, "halton" }
+});
+
+NLOHMANN_JSON_SERIALIZE_ENUM(TileOrder, {
+    { TileOrder::SCANLINE, "scanline" },
+    { TileOrder::MORTON, "morton" },
+    { TileOrder::HILBERT, "hilbert" }
+});
+
+inline void to_json(nlohmann::json &j, const Config::MaterialConfig &material) {
+    j = nlohmann::json{{"color",    material.color},
+                       {"type",     material.type},
+                       {"name",     material.name},
+                       {"emission", material.emission},
+                       {"exponent", material.exponent},
+                       {"ior",      material.ior}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::MaterialConfig &material) {
+    j.at("color").get_to(material.color);
+    j.at("type").get_to(material.type);
+    j.at("name").get_to(material.name);
+    if (j.contains("emission")) j.at("emission").get_to(material.emission);
+    if (j.contains("exponent")) j.at("exponent").get_to(material.exponent);
+    if (j.contains("ior")) j.at("ior").get_to(material.ior);
+}
+
+inline void to_json(nlohmann::json &j, const Config::TransformConfig &transform) {
+    j = nlohmann::json{{"translate", transform.translate},
+                       {"rotate",    transform.rotate},
+                       {"scale",     transform.scale}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::TransformConfig &transform) {
+    if (j.contains("translate")) j.at("translate").get_to(transform.translate);
+    if (j.contains("rotate")) j.at("rotate").get_to(transform.rotate);
+    if (j.contains("scale")) j.at("scale").get_to(transform.scale);
+}
+
+inline void to_json(nlohmann::json &j, const Config::ObjConfig &object) {
+    j = nlohmann::json{{"obj_file_path", object.obj_file_path},
+                       {"material_name", object.material_name},
+                       {"translate",     object.translate},
+                       {"scale",         object.scale},
+                       {"instances",     object.instances}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::ObjConfig &object) {
+    j.at("obj_file_path").get_to(object.obj_file_path);
+    j.at("material_name").get_to(object.material_name);
+    if (j.contains("translate")) j.at("translate").get_to(object.translate);
+    if (j.contains("scale")) j.at("scale").get_to(object.scale);
+    if (j.contains("instances")) j.at("instances").get_to(object.instances);
+}
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::EnvironmentConfig, hdr_file_path, scale);
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::AccelConfig, builder, optimize_iterations, width,
+                                                compressed, cache_dir);
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::RenderConfig, packet_tracing, integrator, wavefront_size,
+                                                sort_rays, group_materials, tile_size, tile_order, threads,
+                                                pass_spp, time_budget, preview_interval, target_error, max_spp,
+                                                russian_roulette_depth, sampler, frame);
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::ObjConfig, obj_file_path, material_name, translate, scale, has_bvh);
+inline void to_json(nlohmann::json &j, const Config &config) {
+    j = nlohmann::json{{"spp",              config.spp},
+                       {"max_depth",        config.max_depth},
+                       {"image_resolution", config.image_resolution},
+                       {"cam_config",       config.cam_config},
+                       {"lights",           config.lights},
+                       {"environment",      config.environment},
+                       {"materials",        config.materials},
+                       {"objects",          config.objects},
+                       {"accel_config",     config.accel_config},
+                       {"render_config",    config.render_config}};
+}
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config,
-                                   spp,
-                                   max_depth,
-                                   image_resolution,
-                                   cam_config,
-                                   light_config,
-                                   materials,
-                                   objects);
+inline void from_json(const nlohmann::json &j, Config &config) {
+    j.at("spp").get_to(config.spp);
+    j.at("max_depth").get_to(config.max_depth);
+    j.at("image_resolution").get_to(config.image_resolution);
+    j.at("cam_config").get_to(config.cam_config);
+    j.at("materials").get_to(config.materials);
+    j.at("objects").get_to(config.objects);
+    // optional sections keep their defaults when missing from the json
+    if (j.contains("lights")) j.at("lights").get_to(config.lights);
+    if (j.contains("light_config")) config.lights.push_back(j.at("light_config").get<Config::LightConfig>());
+    if (j.contains("environment")) j.at("environment").get_to(config.environment);
+    if (j.contains("accel_config")) j.at("accel_config").get_to(config.accel_config);
+    if (j.contains("render_config")) j.at("render_config").get_to(config.render_config);
+}
 
 #endif // CONFIG_IO_H_
\ No newline at end of file
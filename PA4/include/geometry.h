@@ -10,62 +10,23 @@
 #include <vector>
 #include <optional>
 
+/// triangle as loaded from the scene description, packed into a TriangleStore for rendering
 class Triangle {
 public:
     Triangle() = default;
 
-    Triangle(std::vector<Vec3f> vertices, std::vector<Vec3f> normals, AABB aabb);
+    Triangle(const Vec3f &v0, const Vec3f &v1, const Vec3f &v2,
+             const Vec3f &n0, const Vec3f &n1, const Vec3f &n2, int material_id);
     [[nodiscard]] AABB getAABB() const;
-    [[nodiscard]] unsigned int getMortonCode() const;
-    bool intersect(Ray &ray, Interaction &interaction) const;
-    void setMaterial(std::shared_ptr<BSDF> &new_bsdf);
-    void setMortonCode(unsigned int mortonCode);
-    std::vector<Vec3f> getVertices();
+    [[nodiscard]] const Vec3f &getVertex(int i) const;
+    [[nodiscard]] const Vec3f &getNormal(int i) const;
+    /// index into the scene's material table
+    [[nodiscard]] int getMaterialId() const;
 
 private:
-    AABB Box;
-    unsigned int MortonCode{};
-    std::vector<Vec3f> vertices;
-    std::vector<Vec3f> normals;
-    std::shared_ptr<BSDF> bsdf;
-};
-
-class TriangleMesh {
-public:
-    TriangleMesh() = default;
-
-    TriangleMesh(std::vector<Vec3f> vertices,
-                 std::vector<Vec3f> normals,
-                 std::vector<int> v_index,
-                 std::vector<int> n_index);
-
-    bool intersect(Ray &ray, Interaction &interaction) const;
-
-    void setMaterial(std::shared_ptr<BSDF> &new_bsdf);
-
-    void buildBVH();
-
-    std::vector<Vec3f> getVertices();
-
-    std::vector<Vec3f> getNormals();
-
-    std::vector<int> getVIndex();
-
-    std::vector<int> getNIndex();
-
-private:
-    bool intersectOneTriangle(Ray &ray, Interaction &interaction, const Vec3i &v_idx, const Vec3i &n_idx) const;
-
-    void bvhHit(BVHNode *p, Interaction &interaction,
-                Ray &ray) const;
-
-    std::shared_ptr<BSDF> bsdf;
-    BVHNode *bvh{};
-
-    std::vector<Vec3f> vertices;
-    std::vector<Vec3f> normals;
-    std::vector<int> v_indices;
-    std::vector<int> n_indices;
+    Vec3f vertices[3];
+    Vec3f normals[3];
+    int material_id{-1};
 };
 
 #endif // GEOMETRY_H_
@@ -19,8 +19,14 @@ public:
 
     void setPixel(int x, int y, const Vec3f &value);
 
+    /// copy a width x height block of row-major values with its first pixel at (x0, y0)
+    void setBlock(int x0, int y0, int width, int height, const Vec3f *values);
+
     void writeImgToFile(const std::string &file_name);
 
+    /// row-major linear values
+    [[nodiscard]] const std::vector<Vec3f> &getData() const { return data; }
+
 private:
     std::vector<Vec3f> data;
     Vec2i resolution;
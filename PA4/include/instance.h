@@ -0,0 +1,114 @@
+#ifndef INSTANCE_H_
+#define INSTANCE_H_
+
+#include "core.h"
+#include "ray.h"
+#include "accel.h"
+#include "geometry.h"
+#include "config.h"
+#include "wide_bvh.h"
+#include "triangle_store.h"
+#include "ray_packet.h"
+
+#include <vector>
+
+/// Bottom-level acceleration structure: the triangles of one mesh in its object space with a BVH
+/// over them. Every mesh file is built once and shared by all instances placing it in the scene.
+class BLAS {
+public:
+    BLAS() = default;
+
+    /// Build with the builder, restructuring passes and node layout of accel_config. prim_order
+    /// receives the BVH order of the triangles, the prim ids of hits refer to that order.
+    void build(const std::vector<Triangle> &triangles, const Config::AccelConfig &accel_config,
+               std::vector<int> &prim_order);
+
+    /// closest hit in object space, hit.t bounds the search on entry
+    bool intersect(const TraversalRay &ray, HitRecord &hit) const;
+
+    /// any hit in [ray.t_min, ray.t_max)
+    [[nodiscard]] bool occluded(const TraversalRay &ray) const;
+
+    /// closest hits of the rays of a coherent packet in active (one bit per ray)
+    void intersectPacket(RayPacket &packet, uint64_t active) const;
+
+    [[nodiscard]] const TriangleStore &getTriangles() const { return triangles; }
+
+    /// binary BVH the traversed layout was collapsed from
+    [[nodiscard]] const std::vector<LBVHNode> &getLBVH() const { return LBVH; }
+
+    [[nodiscard]] AABB getBounds() const { return LBVH.empty() ? AABB() : LBVH[0].aabb; }
+
+    /// size in bytes of the nodes traversed by intersect
+    [[nodiscard]] size_t getBVHMemorySize() const;
+
+    /// the packed triangles, the binary BVH and the collapsed layout in use
+    void write(BinaryWriter &writer) const;
+
+    /// read what write stored, false when the data is truncated or inconsistent, or when indices
+    /// are out of range; triangle material ids have to lie in [0, material_count)
+    bool read(BinaryReader &reader, int material_count);
+
+private:
+    TriangleStore triangles;
+    std::vector<LBVHNode> LBVH;
+    int bvh_width{2};
+    bool bvh_compressed{false};
+    // only the layout that is traversed is built
+    WideBVH<4> wide_bvh4;
+    WideBVH<8> wide_bvh8;
+    QuantizedWideBVH<4> quantized_bvh4;
+    QuantizedWideBVH<8> quantized_bvh8;
+};
+
+/// One placement of a BLAS in the scene. Rays are moved into object space for traversal; their
+/// directions are not renormalized, so hit distances hold in world space.
+struct Instance {
+    int blas_id;
+    /// material of all triangles, -1 to use the material ids of the triangles
+    int material_id;
+    /// first entry of the instance in the scene's prim_lights, -1 when its triangles do not emit
+    int light_offset{-1};
+    /// object to world: x -> linear * x + translation
+    Mat3f linear;
+    Vec3f translation;
+    /// world to object
+    Mat3f inv_linear;
+    Vec3f inv_translation;
+    /// world space bounds
+    AABB bounds;
+    /// object space is world space, rays are traced as they are
+    bool identity;
+
+    Instance(int blas_id, int material_id, const Mat3f &linear, const Vec3f &translation,
+             const AABB &object_bounds);
+
+    /// any hit with the BLAS of the instance, if ray reaches its bounds
+    [[nodiscard]] bool occluded(const BLAS &blas, const TraversalRay &ray) const {
+        float t_in;
+        if (!bounds.intersect(ray, ray.t_max, t_in)) return false;
+        return blas.occluded(toObject(ray));
+    }
+
+    /// ray in object space, the ray itself for identity instances
+    [[nodiscard]] TraversalRay toObject(const TraversalRay &ray) const {
+        if (identity) return ray;
+        return TraversalRay(Ray(inv_linear * ray.origin + inv_translation, inv_linear * ray.direction,
+                                ray.t_min, ray.t_max));
+    }
+
+    [[nodiscard]] Vec3f normalToWorld(const Vec3f &normal) const {
+        return (inv_linear.transpose() * normal).normalized();
+    }
+
+    /// the triangle placed in world space, with the material of the instance
+    [[nodiscard]] Triangle toWorld(const Triangle &triangle) const;
+};
+
+/// triangle mapped by x -> linear * x + translation, normals are not renormalized
+Triangle transformTriangle(const Triangle &triangle, const Mat3f &linear, const Vec3f &translation, int material_id);
+
+/// transform of a TransformConfig: scale, then rotation about x, y and z, then translation
+void transformFromConfig(const Config::TransformConfig &transform, Mat3f &linear, Vec3f &translation);
+
+#endif //INSTANCE_H_
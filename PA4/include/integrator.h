@@ -4,23 +4,75 @@
 #include "camera.h"
 #include "scene.h"
 #include "interaction.h"
+#include "sampler.h"
 
 class Integrator {
 public:
     Integrator(std::shared_ptr<Camera> cam,
-               std::shared_ptr<Scene> scene, int spp, int max_depth);
+               std::shared_ptr<Scene> scene, int spp, int max_depth,
+               const Config::RenderConfig &render_config = {});
 
-    void render() const;
+    virtual ~Integrator() = default;
+
+    virtual void render() const;
 
     Vec3f radiance(Ray &ray, Sampler &sampler) const;
 
-private:
+    /// radiance along a camera ray whose first hit has already been found
+    Vec3f radiance(Ray &ray, Interaction &interaction, Sampler &sampler) const;
+
+protected:
     Vec3f directLighting(Interaction &interaction, Sampler &sampler) const;
 
+    /// Pick a light with the light BVH and sample a point on it for next event estimation. shadow_ray
+    /// is aimed at the sample and contribution is what the light adds if the shadow ray is unoccluded,
+    /// MIS weighted against BSDF sampling with the power heuristic. False for delta materials and
+    /// samples that cannot contribute.
+    bool sampleLight(Interaction &interaction, Sampler &sampler, Ray &shadow_ray, Vec3f &contribution) const;
+
+    /// Emission of light light_id from pos reaching the origin of ray, which was sampled from the BSDF
+    /// with bsdf_pdf at a surface with normal. MIS weighted against light sampling, unweighted when
+    /// bsdf_pdf is 0 (camera rays and delta bounces, which light sampling cannot produce).
+    [[nodiscard]] Vec3f emittedRadiance(const Ray &ray, int light_id, const Vec3f &pos, float bsdf_pdf,
+                                        const Vec3f &normal) const;
+
+    /// emission of the infinite lights along ray, which escaped the scene, weighted as in emittedRadiance
+    [[nodiscard]] Vec3f escapedRadiance(const Ray &ray, float bsdf_pdf, const Vec3f &normal) const;
+
+    /// Russian roulette after bounce depth (0 for the first). Returns false when the path is
+    /// terminated, otherwise divides beta by the survival probability to keep the estimate unbiased.
+    bool survive(int depth, Vec3f &beta, Sampler &sampler) const;
+
+    /// per-pixel sums over the samples of one tile, row-major
+    struct TileFilm {
+        std::vector<Vec3f> radiance;
+        // squared luminance, for the variance estimate of adaptive sampling
+        std::vector<float> luminance_sq;
+    };
+
+    /// Sums over samples [first_sample, first_sample + sample_count) of the pixels of the tile with
+    /// its top left pixel at origin. Pixels whose entry in the image-sized active mask is 0 are skipped.
+    void renderTile(const Vec2i &origin, int first_sample, int sample_count, const std::vector<char> &active,
+                    Sampler &sampler, TileFilm &film) const;
+
+    /// standard error of the mean luminance of a pixel, as it shows in the gamma corrected output
+    static float displayError(const Vec3f &radiance_sum, float luminance_sq_sum, int sample_count);
+
     std::shared_ptr<Camera> camera;
     std::shared_ptr<Scene> scene;
     int max_depth;
     int spp;
+    bool packet_tracing;
+    int tile_size;
+    TileOrder tile_order;
+    int pass_spp;
+    float time_budget;
+    float preview_interval;
+    float target_error;
+    int max_spp;
+    int russian_roulette_depth;
+    SamplerType sampler_type;
+    int frame;
 };
 
 #endif //INTEGRATOR_H_
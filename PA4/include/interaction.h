@@ -2,7 +2,6 @@
 #define INTERACTION_H_
 
 #include "core.h"
-#include <memory>
 
 struct Interaction {
     enum Type {
@@ -11,10 +10,25 @@ struct Interaction {
     Vec3f pos{0, 0, 0};
     float dist{RAY_DEFAULT_MAX};
     Vec3f normal{0, 0, 0};
-    std::shared_ptr<BSDF> material{nullptr};
+    /// index into the scene's material table
+    int material_id{-1};
     Vec3f wi{0, 0, 0};
     Vec3f wo{0, 0, 0};
     Type type{Type::NONE};
+    /// index of the emitter in the scene's light list, for LIGHT interactions
+    int light_id{-1};
+};
+
+/// compact record of the closest hit found during traversal.
+/// surface attributes are only interpolated for the final hit, see TriangleStore::fillInteraction
+struct HitRecord {
+    float t{RAY_DEFAULT_MAX};
+    /// triangle within the BLAS of the instance
+    int prim_id{-1};
+    /// barycentric coordinates of the hit point
+    float u{0};
+    float v{0};
+    int instance_id{-1};
 };
 
 #endif //INTERACTION_H_
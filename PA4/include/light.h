@@ -1,12 +1,37 @@
 #ifndef LIGHT_H_
 #define LIGHT_H_
 
+#include <string>
 #include <vector>
 
 #include "core.h"
 #include "ray.h"
 #include "geometry.h"
 
+/// Bounds of the emission of one light or a group of lights, the light BVH estimates from them how
+/// much a group can contribute to a receiver. Normals lie in the cone of half angle theta_o around w,
+/// light leaves up to theta_e past the normals.
+struct LightBounds {
+    AABB bounds;
+    /// emitted power
+    float phi{0};
+    Vec3f w{0, 0, 1};
+    float cos_theta_o{1};
+    /// 0 for area lights, which emit over the hemisphere of their normal
+    float cos_theta_e{0};
+
+    LightBounds() = default;
+
+    LightBounds(AABB bounds, float phi, const Vec3f &w, float cos_theta_o, float cos_theta_e);
+
+    /// bounds of the union of two groups
+    LightBounds(const LightBounds &a, const LightBounds &b);
+
+    /// conservative estimate of the power the group sends to a receiver at pos with normal,
+    /// 0 when no point of the group can light it
+    [[nodiscard]] float importance(const Vec3f &pos, const Vec3f &normal) const;
+};
+
 class Light {
 public:
     Light() = default;
@@ -15,13 +40,25 @@ public:
 
     virtual ~Light() = default;
 
+    /// radiance leaving the light at pos towards -dir, dir points from the receiver to the light
     [[nodiscard]] virtual Vec3f emission(const Vec3f &pos, const Vec3f &dir) const = 0;
 
-    virtual float pdf(const Interaction &interaction, Vec3f pos) = 0;
+    /// solid angle density, as seen from ref, with which sample() picks the point pos on the light
+    [[nodiscard]] virtual float pdf(const Vec3f &ref, const Vec3f &pos) const = 0;
 
+    /// sample a point on the light for the receiver at interaction.pos, its solid angle density is
+    /// stored to pdf if not null and is 0 when the point faces away from the receiver
     [[nodiscard]] virtual Vec3f sample(Interaction &interaction, float *pdf, Sampler &sampler) const = 0;
 
-    virtual bool intersect(Ray &ray, Interaction &interaction) const = 0;
+    /// bounds for the light BVH, not used for infinite lights
+    [[nodiscard]] virtual LightBounds getBounds() const = 0;
+
+    /// lights without geometry that surround the scene, they are left out of the light BVH and
+    /// light the rays that escape the scene
+    [[nodiscard]] virtual bool isInfinite() const { return false; }
+
+    /// called by the scene with the bounds of its geometry, infinite lights place their samples outside them
+    virtual void setSceneBounds(const AABB &) {}
 
 protected:
     /// position of light in world space
@@ -40,16 +77,80 @@ public:
 
     [[nodiscard]] Vec3f emission(const Vec3f &pos, const Vec3f &dir) const override;
 
-    float pdf(const Interaction &interaction, Vec3f pos) override;
+    [[nodiscard]] float pdf(const Vec3f &ref, const Vec3f &pos) const override;
 
     [[nodiscard]] Vec3f sample(Interaction &interaction, float *pdf, Sampler &sampler) const override;
 
-    bool intersect(Ray &ray, Interaction &interaction) const override;
+    [[nodiscard]] LightBounds getBounds() const override;
+
+    /// the two triangles of the light, rays find it through the scene BVH like any other geometry
+    [[nodiscard]] std::vector<Triangle> getTriangles(int material_id) const;
 
 protected:
-    // build light mesh from position and size. position locates at the center of rectangle.
-    TriangleMesh light_mesh;
     Vec2f size;
 };
 
+/// one triangle of an emissive mesh, emitting from the side of its normal
+class TriangleLight : public Light {
+public:
+    TriangleLight(const Triangle &triangle, const Vec3f &color);
+
+    [[nodiscard]] Vec3f emission(const Vec3f &pos, const Vec3f &dir) const override;
+
+    [[nodiscard]] float pdf(const Vec3f &ref, const Vec3f &pos) const override;
+
+    [[nodiscard]] Vec3f sample(Interaction &interaction, float *pdf, Sampler &sampler) const override;
+
+    [[nodiscard]] LightBounds getBounds() const override;
+
+private:
+    Vec3f vertices[3];
+    // geometric normal, turned towards the vertex normals of the mesh
+    Vec3f normal;
+    float area;
+};
+
+/// Environment around the scene from an equirectangular HDR image, the top row is straight up (+y).
+/// Directions are importance sampled in proportion to texel luminance through a marginal CDF over
+/// the rows and a conditional CDF within every row.
+class EnvironmentLight : public Light {
+public:
+    /// scale multiplies the radiance of the image
+    EnvironmentLight(const std::string &hdr_file_path, float scale);
+
+    /// radiance arriving from direction dir, pos is ignored
+    [[nodiscard]] Vec3f emission(const Vec3f &pos, const Vec3f &dir) const override;
+
+    /// solid angle density of the direction from ref towards pos
+    [[nodiscard]] float pdf(const Vec3f &ref, const Vec3f &pos) const override;
+
+    /// the sampled point lies the scene diameter away from interaction.pos, outside all geometry
+    [[nodiscard]] Vec3f sample(Interaction &interaction, float *pdf, Sampler &sampler) const override;
+
+    [[nodiscard]] LightBounds getBounds() const override;
+
+    [[nodiscard]] bool isInfinite() const override { return true; }
+
+    void setSceneBounds(const AABB &bounds) override;
+
+    [[nodiscard]] Vec2i getResolution() const { return {width, height}; }
+
+private:
+    /// index of the texel that direction dir falls into
+    [[nodiscard]] int texelIndex(const Vec3f &dir) const;
+
+    int width{0};
+    int height{0};
+    std::vector<Vec3f> texels;
+    // luminance times the sine of the row's polar angle, the density of the samples over the image
+    std::vector<float> weights;
+    // width + 1 entries per row
+    std::vector<float> conditional_cdf;
+    std::vector<float> marginal_cdf;
+    // mean of the weights
+    float weight_mean{0};
+    // twice the radius of the bounding sphere of the scene, shadow rays to samples span all of it
+    float scene_diameter{1};
+};
+
 #endif //LIGHT_H_
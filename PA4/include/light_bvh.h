@@ -0,0 +1,46 @@
+#ifndef LIGHT_BVH_H_
+#define LIGHT_BVH_H_
+
+#include "core.h"
+#include "accel.h"
+#include "light.h"
+
+#include <memory>
+#include <vector>
+
+/// BVH over the lights of the scene for picking one light per shading point. Every node keeps the
+/// LightBounds of its lights, traversal descends into a child with probability proportional to the
+/// importance of its bounds for the receiver, and leaves pick among their lights the same way.
+class LightBVH {
+public:
+    LightBVH() = default;
+
+    /// build over the finite lights with the binned SAH builder, the topology is that of the scene BVH
+    void build(const std::vector<std::shared_ptr<Light>> &lights);
+
+    /// true when there are no finite lights
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+
+    /// Index of a light for the receiver at pos with normal, u in [0, 1) chooses among them. The
+    /// probability of the choice is stored to pmf. -1 when no light can reach the receiver.
+    [[nodiscard]] int sample(const Vec3f &pos, const Vec3f &normal, float u, float &pmf) const;
+
+    /// probability with which sample picks the finite light light_id for the same receiver
+    [[nodiscard]] float pmf(const Vec3f &pos, const Vec3f &normal, int light_id) const;
+
+private:
+    /// importances of the lights of a leaf, returns their sum
+    float leafImportance(const LBVHNode &leaf, const Vec3f &pos, const Vec3f &normal, float *importance) const;
+
+    std::vector<LBVHNode> nodes;
+    std::vector<LightBounds> node_bounds;
+    std::vector<int> parents;
+    // leaf ranges index the lights in leaf order
+    std::vector<LightBounds> light_bounds;
+    std::vector<int> light_order;
+    // position of every light in leaf order and the leaf holding it, -1 for infinite lights
+    std::vector<int> light_slots;
+    std::vector<int> light_leaves;
+};
+
+#endif //LIGHT_BVH_H_
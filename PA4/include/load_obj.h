@@ -6,10 +6,20 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
-static bool loadObj(const std::string &path, std::vector<Vec3f> &vertices,
-                    std::vector<Vec3f> &normals, std::vector<int> &v_index, std::vector<int> &n_index);
+/// positions, normals and triangles of an obj file. texture coordinates, groups and materials are skipped.
+struct ObjMesh {
+    std::vector<Vec3f> vertices;
+    std::vector<Vec3f> normals;
+    // three indices per triangle, faces with more vertices are triangulated. a missing normal is -1.
+    std::vector<int> v_index;
+    std::vector<int> n_index;
+};
 
-std::shared_ptr<TriangleMesh> makeMeshObject(std::string path_to_obj, Vec3f translation, float scale);
+/// Parse the obj files at paths into meshes, in the same order. All files are mapped into memory
+/// and split into chunks of whole lines, which are parsed in parallel straight into the arrays of
+/// their mesh. Exits when a file cannot be read or refers to a vertex or normal it does not have.
+void loadObjFiles(const std::vector<std::string> &paths, std::vector<ObjMesh> &meshes);
 
 #endif //LOAD_OBJ_H_
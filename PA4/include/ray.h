@@ -22,4 +22,24 @@ struct Ray {
     }
 };
 
+/// ray with the per-ray constants of the slab test precomputed, used for BVH traversal
+struct TraversalRay {
+    Vec3f origin;
+    Vec3f direction;
+    /// reciprocal direction, zero components are replaced by a large finite value
+    Vec3f inv_direction;
+    /// 1 where the direction component is negative, selects the near and far slab planes
+    int sign[3];
+    float t_min;
+    float t_max;
+
+    explicit TraversalRay(const Ray &ray)
+            : origin(ray.origin), direction(ray.direction), t_min(ray.t_min), t_max(ray.t_max) {
+        for (int i = 0; i < 3; ++i) {
+            inv_direction[i] = direction[i] == 0.0f ? 1.0e32f : 1.0f / direction[i];
+            sign[i] = inv_direction[i] < 0;
+        }
+    }
+};
+
 #endif //RAY_H_
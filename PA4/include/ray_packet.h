@@ -0,0 +1,206 @@
+#ifndef RAY_PACKET_H_
+#define RAY_PACKET_H_
+
+#include "core.h"
+#include "ray.h"
+#include "accel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+// camera rays are traced in square packets of PACKET_WIDTH x PACKET_WIDTH pixels
+constexpr int PACKET_WIDTH = 8;
+constexpr int PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+// rays are processed in SIMD groups of PACKET_LANES
+constexpr int PACKET_LANES = 8;
+
+/// SoA packet of rays with the closest hit of each ray. Traversal culls nodes against the
+/// interval bounds of the packet, which are only valid when all rays share direction signs.
+struct alignas(32) RayPacket {
+    float origin[3][PACKET_SIZE];
+    float direction[3][PACKET_SIZE];
+    float inv_direction[3][PACKET_SIZE];
+    float t_min;
+    /// closest hit distance of each ray, bounds its search like HitRecord::t
+    alignas(32) float t_max[PACKET_SIZE];
+    int prim_id[PACKET_SIZE];
+    int instance_id[PACKET_SIZE];
+    float u[PACKET_SIZE];
+    float v[PACKET_SIZE];
+    /// interval bounds of origins and reciprocal directions over the packet
+    float origin_min[3], origin_max[3];
+    float inv_direction_min[3], inv_direction_max[3];
+    /// largest t_max over the packet, nodes entered beyond it are culled as a whole
+    float farthest_t_max;
+    /// 1 where all directions are negative
+    int sign[3];
+    /// false when the direction signs differ, interval culling is not valid then
+    bool coherent{true};
+
+    /// load PACKET_SIZE rays, t_max[i] bounds the search of ray i
+    RayPacket(const Ray *rays, const float *ray_t_max) : t_min(rays[0].t_min) {
+        for (int i = 0; i < PACKET_SIZE; ++i) setRay(i, TraversalRay(rays[i]), ray_t_max[i]);
+        computeBounds();
+    }
+
+    /// The rays of packet mapped by x -> linear * x + translation, directions are not renormalized
+    /// so hit distances carry over. Only the rays in active (one bit per ray) can record hits.
+    RayPacket(const RayPacket &packet, const Mat3f &linear, const Vec3f &translation, uint64_t active)
+            : t_min(packet.t_min) {
+        for (int i = 0; i < PACKET_SIZE; ++i) {
+            Vec3f o(packet.origin[0][i], packet.origin[1][i], packet.origin[2][i]);
+            Vec3f d(packet.direction[0][i], packet.direction[1][i], packet.direction[2][i]);
+            // inactive rays end before they start
+            float ray_t_max = (active >> i) & 1 ? packet.t_max[i] : -std::numeric_limits<float>::infinity();
+            setRay(i, TraversalRay(Ray(linear * o + translation, linear * d, t_min)), ray_t_max);
+        }
+        computeBounds();
+    }
+
+    /// recompute farthest_t_max after hits were recorded
+    SIMD_TARGET void updateFarthest() {
+        using Float = FloatN<PACKET_LANES>;
+        Float farthest = Float::load(t_max);
+        for (int group = PACKET_LANES; group < PACKET_SIZE; group += PACKET_LANES) {
+            farthest = max(farthest, Float::load(t_max + group));
+        }
+        alignas(32) float lanes[PACKET_LANES];
+        farthest.store(lanes);
+        farthest_t_max = *std::max_element(lanes, lanes + PACKET_LANES);
+    }
+
+    /// Index of the first ray from first on that hits box within its t_max, PACKET_SIZE if none.
+    /// The first active ray is tried alone, then the whole packet is culled by interval arithmetic,
+    /// and only then are the remaining rays tested in SIMD groups.
+    SIMD_TARGET int firstHit(const AABB &box, int first) const {
+        if (rayHits(box, first)) return first;
+        if (intervalMiss(box)) return PACKET_SIZE;
+        using Float = FloatN<PACKET_LANES>;
+        for (int group = (first + 1) / PACKET_LANES * PACKET_LANES; group < PACKET_SIZE; group += PACKET_LANES) {
+            Float t_in(t_min), t_out = Float::load(t_max + group);
+            for (int axis = 0; axis < 3; ++axis) {
+                Float near(sign[axis] ? box.upper_bnd[axis] : box.low_bnd[axis]);
+                Float far(sign[axis] ? box.low_bnd[axis] : box.upper_bnd[axis]);
+                Float o = Float::load(origin[axis] + group), r = Float::load(inv_direction[axis] + group);
+                t_in = max(t_in, (near - o) * r);
+                t_out = min(t_out, (far - o) * r);
+            }
+            // lanes before first + 1 were already handled
+            int mask = lessEqualMask(t_in, t_out) & (~0u << std::max(first + 1 - group, 0));
+            if (mask != 0) return group + __builtin_ctz(mask);
+        }
+        return PACKET_SIZE;
+    }
+
+    /// bit i is set when ray i (from first on) hits box within its t_max
+    SIMD_TARGET uint64_t activeMask(const AABB &box, int first) const {
+        using Float = FloatN<PACKET_LANES>;
+        uint64_t active = 0;
+        for (int group = first / PACKET_LANES * PACKET_LANES; group < PACKET_SIZE; group += PACKET_LANES) {
+            Float t_in(t_min), t_out = Float::load(t_max + group);
+            for (int axis = 0; axis < 3; ++axis) {
+                Float near(sign[axis] ? box.upper_bnd[axis] : box.low_bnd[axis]);
+                Float far(sign[axis] ? box.low_bnd[axis] : box.upper_bnd[axis]);
+                Float o = Float::load(origin[axis] + group), r = Float::load(inv_direction[axis] + group);
+                t_in = max(t_in, (near - o) * r);
+                t_out = min(t_out, (far - o) * r);
+            }
+            active |= (uint64_t) lessEqualMask(t_in, t_out) << group;
+        }
+        return active;
+    }
+
+private:
+    void setRay(int i, const TraversalRay &ray, float ray_t_max) {
+        for (int axis = 0; axis < 3; ++axis) {
+            origin[axis][i] = ray.origin[axis];
+            direction[axis][i] = ray.direction[axis];
+            inv_direction[axis][i] = ray.inv_direction[axis];
+        }
+        t_max[i] = ray_t_max;
+        prim_id[i] = instance_id[i] = -1;
+        u[i] = v[i] = 0;
+    }
+
+    /// interval bounds and coherence of the loaded rays
+    void computeBounds() {
+        for (int axis = 0; axis < 3; ++axis) {
+            sign[axis] = inv_direction[axis][0] < 0;
+            origin_min[axis] = *std::min_element(origin[axis], origin[axis] + PACKET_SIZE);
+            origin_max[axis] = *std::max_element(origin[axis], origin[axis] + PACKET_SIZE);
+            inv_direction_min[axis] = *std::min_element(inv_direction[axis], inv_direction[axis] + PACKET_SIZE);
+            inv_direction_max[axis] = *std::max_element(inv_direction[axis], inv_direction[axis] + PACKET_SIZE);
+            for (int i = 0; i < PACKET_SIZE; ++i) coherent &= (inv_direction[axis][i] < 0) == sign[axis];
+        }
+        updateFarthest();
+    }
+
+    [[nodiscard]] bool rayHits(const AABB &box, int i) const {
+        float t_in = t_min, t_out = t_max[i];
+        for (int axis = 0; axis < 3; ++axis) {
+            float near = sign[axis] ? box.upper_bnd[axis] : box.low_bnd[axis];
+            float far = sign[axis] ? box.low_bnd[axis] : box.upper_bnd[axis];
+            t_in = std::max(t_in, (near - origin[axis][i]) * inv_direction[axis][i]);
+            t_out = std::min(t_out, (far - origin[axis][i]) * inv_direction[axis][i]);
+        }
+        return t_in <= t_out;
+    }
+
+    /// conservative test that no ray of the packet can hit box
+    [[nodiscard]] bool intervalMiss(const AABB &box) const {
+        float t_in = t_min, t_out = farthest_t_max;
+        for (int axis = 0; axis < 3; ++axis) {
+            float near = sign[axis] ? box.upper_bnd[axis] : box.low_bnd[axis];
+            float far = sign[axis] ? box.low_bnd[axis] : box.upper_bnd[axis];
+            // smallest entrance and largest exit distance over all origins and directions
+            float near_lo = near - origin_max[axis], near_hi = near - origin_min[axis];
+            float far_lo = far - origin_max[axis], far_hi = far - origin_min[axis];
+            float r_lo = inv_direction_min[axis], r_hi = inv_direction_max[axis];
+            t_in = std::max(t_in, std::min({near_lo * r_lo, near_lo * r_hi, near_hi * r_lo, near_hi * r_hi}));
+            t_out = std::min(t_out, std::max({far_lo * r_lo, far_lo * r_hi, far_hi * r_lo, far_hi * r_hi}));
+        }
+        return t_in > t_out;
+    }
+};
+
+/// Closest hits of a coherent packet in a flattened binary BVH. leaf_test(begin, end, active) records
+/// the hits of the rays in active (one bit per ray) with the inclusive primitive range.
+template<typename LeafTest>
+void intersectPacketBVH(const std::vector<LBVHNode> &nodes, RayPacket &packet, LeafTest &&leaf_test) {
+    struct StackEntry {
+        int idx;
+        int first;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    StackEntry current{0, 0};
+    if (nodes.empty()) return;
+    while (true) {
+        const LBVHNode &node = nodes[current.idx];
+        // rays before the first active one missed an ancestor and stay inactive below it
+        current.first = packet.firstHit(node.aabb, current.first);
+        if (current.first < PACKET_SIZE) {
+            if (node.triangle_begin_idx != -1) {
+                leaf_test(node.triangle_begin_idx, node.triangle_end_idx, packet.activeMask(node.aabb, current.first));
+                packet.updateFarthest();
+            } else {
+                // visit the child lying first along the direction of the first active ray
+                int left = current.idx + 1, right = node.right_idx;
+                Vec3f offset = nodes[right].aabb.low_bnd + nodes[right].aabb.upper_bnd
+                               - nodes[left].aabb.low_bnd - nodes[left].aabb.upper_bnd;
+                float along = 0;
+                for (int axis = 0; axis < 3; ++axis) along += offset[axis] * packet.direction[axis][current.first];
+                if (along < 0) std::swap(left, right);
+                stack[stack_size++] = {right, current.first};
+                current.idx = left;
+                continue;
+            }
+        }
+        if (stack_size == 0) return;
+        current = stack[--stack_size];
+    }
+}
+
+#endif //RAY_PACKET_H_
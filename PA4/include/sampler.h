@@ -0,0 +1,97 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include "core.h"
+#include "config.h"
+
+#include <cstdint>
+#include <memory>
+
+/// Source of the random numbers in [0, 1) of an integrator. Values are drawn one dimension after
+/// another for one sample of one pixel: the camera ray takes the first two dimensions, every
+/// light and BSDF sample and every roulette decision of the path the following ones.
+class Sampler {
+public:
+    /// frame is hashed into every value, different frames get independent noise
+    explicit Sampler(int frame = 0) : frame(frame) { startPixelSample(Vec2i(0, 0), 0); }
+
+    virtual ~Sampler() = default;
+
+    /// draw the following values for sample sample_index of pixel, starting at dimension
+    void startPixelSample(const Vec2i &pixel_pos, int index, int dim = 0) {
+        pixel = pixel_pos;
+        sample_index = index;
+        dimension = dim;
+        pixel_hash = hashPixel();
+        sample_hash = hashSample();
+    }
+
+    [[nodiscard]] int getDimension() const { return dimension; }
+
+    virtual float get1D() = 0;
+
+    virtual Vec2f get2D() = 0;
+
+protected:
+    /// hash of the pixel, frame and dimension, the same for all samples of the pixel
+    [[nodiscard]] uint32_t pixelSeed(int dim) const;
+
+    int frame;
+    Vec2i pixel{0, 0};
+    int sample_index{0};
+    int dimension{0};
+    /// 64-bit hash of the pixel, frame and sample index
+    uint64_t sample_hash{0};
+
+private:
+    // computed once per pixel sample instead of once per value
+    [[nodiscard]] uint32_t hashPixel() const;
+
+    [[nodiscard]] uint64_t hashSample() const;
+
+    uint32_t pixel_hash{0};
+};
+
+/// Independent uniform values from a counter-based generator: every value is a hash of the
+/// pixel, sample, frame and dimension, so it does not depend on which thread draws it or when.
+class IndependentSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+
+    Vec2f get2D() override;
+
+private:
+    [[nodiscard]] uint64_t next();
+};
+
+/// Owen scrambled 2D Sobol points, the (0,2)-sequence. Every pair of dimensions gets its own
+/// scrambling and its own shuffle of the sample indices, so the samples of a pixel are
+/// stratified in each pair while different pairs stay uncorrelated.
+class SobolSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+
+    Vec2f get2D() override;
+};
+
+/// Halton sequence with one prime base per dimension, the digits of every pixel are scrambled
+/// by a hash of the digits above them
+class HaltonSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+
+    Vec2f get2D() override;
+
+private:
+    [[nodiscard]] float radicalInverse(int dim) const;
+};
+
+std::unique_ptr<Sampler> createSampler(SamplerType type, int frame = 0);
+
+#endif //SAMPLER_H_
@@ -7,49 +7,97 @@
 #include "image.h"
 #include "geometry.h"
 #include "light.h"
+#include "light_bvh.h"
 #include "interaction.h"
 #include "config.h"
+#include "instance.h"
+#include "ray_packet.h"
 
 class Scene {
 public:
-    Scene() = default;
+    Scene();
 
-    void addObject(std::shared_ptr<TriangleMesh> &geometry);
+    /// emitters of the scene, indexed by Interaction::light_id
+    [[nodiscard]] const std::vector<std::shared_ptr<Light>> &getLights() const;
 
-    [[nodiscard]] const std::shared_ptr<Light> &getLight() const;
+    /// Set the emitters and build the light BVH over them. The light of triangle prim_id of an
+    /// instance is prim_lights[Instance::light_offset + prim_id], -1 for triangles that do not emit.
+    /// Infinite lights are fitted around the geometry, so it has to be set first.
+    void setLights(std::vector<std::shared_ptr<Light>> new_lights, std::vector<int> new_prim_lights);
 
-    void setLight(const std::shared_ptr<Light> &new_light);
+    /// indices of the infinite lights, they light the rays that escape the scene
+    [[nodiscard]] const std::vector<int> &getInfiniteLights() const;
 
-    bool isShadowed(Ray &shadow_ray);
+    /// Pick a light for the receiver at pos with normal. Every infinite light and the light BVH get
+    /// an even share, the BVH picks by importance, see LightBVH::sample. -1 when no light can reach
+    /// the receiver.
+    int sampleLight(const Vec3f &pos, const Vec3f &normal, float u, float &pmf) const;
 
-    bool intersect(Ray &ray, Interaction &interaction);
+    /// probability with which sampleLight picks light_id for the receiver
+    [[nodiscard]] float lightPmf(const Vec3f &pos, const Vec3f &normal, int light_id) const;
+
+    /// Closest hits of PACKET_SIZE rays, traced together through the TLAS and the binary BVHs of the
+    /// meshes when their direction signs agree and one by one otherwise.
+    void intersectPacket(Ray *rays, Interaction *interactions);
 
-    BVHNode *getBVHNode();
+    /// any-hit occlusion query against the scene geometry in [ray.t_min, ray.t_max).
+    /// emitters are geometry too, shadow rays should end just before the sampled light point.
+    bool occluded(const Ray &ray) const;
+
+    bool intersect(Ray &ray, Interaction &interaction);
 
-    void setBVHRoot(BVHNode *root);
+    /// closest hit through the TLAS and the BLAS of every instance it reaches, hit.t bounds the
+    /// search on entry
+    bool intersect(const TraversalRay &ray, HitRecord &hit) const;
 
-    BVHNode *buildBVH(int start, int end);
+    /// set the meshes and their instances, and build the TLAS over the instance bounds
+    void setGeometry(std::vector<BLAS> new_meshes, std::vector<Instance> new_instances);
 
-    int findSplit(int start, int end);
+    /// material table indexed by Instance::material_id
+    void setMaterials(std::vector<BSDF> new_materials);
 
-    void bvhIntersect(BVHNode *root, Interaction &interaction, Ray &ray);
+    /// material of Interaction::material_id
+    [[nodiscard]] const BSDF &getMaterial(int material_id) const { return materials[material_id]; }
 
-    void setTriangles(std::vector<Triangle> new_Triangles);
+    /// size in bytes of the packed triangles of all meshes, each counted once however often it is placed
+    [[nodiscard]] size_t getTriangleMemorySize() const;
 
-    void DFS(BVHNode *root);
+    /// bounds of all scene geometry, emitters included
+    [[nodiscard]] AABB getBounds() const;
 
-    [[nodiscard]] std::vector<LBVHNode>getLBVH() const;
+    /// size in bytes of the nodes traversed by intersect, the TLAS and every BLAS
+    [[nodiscard]] size_t getBVHMemorySize() const;
 
-    void lbvhIntersect(int idx, Interaction &interaction, Ray &ray);
+    /// number of rays traced by intersect since construction, summed over all threads
+    [[nodiscard]] unsigned long long getRayCount() const;
 
-//    void buildLBVH()
+    /// number of those rays that were occlusion queries
+    [[nodiscard]] unsigned long long getOcclusionRayCount() const;
 
 private:
-    std::vector<std::shared_ptr<TriangleMesh>> objects;
-    std::shared_ptr<Light> light;
-    BVHNode *bvhNode{nullptr};
-    std::vector<Triangle> Triangles;
-    std::vector<LBVHNode> LBVH{};
+    /// closest hits of the rays of a coherent packet in active with instance instance_id
+    void intersectPacketInstance(RayPacket &packet, int instance_id, uint64_t active) const;
+
+    /// surface attributes, material and emitter of the closest hit
+    void fillHit(const Ray &ray, const HitRecord &hit, Interaction &interaction) const;
+
+    std::vector<std::shared_ptr<Light>> lights;
+    // light of every triangle, -1 for none
+    std::vector<int> prim_lights;
+    std::vector<int> infinite_lights;
+    LightBVH light_bvh;
+    std::vector<BSDF> materials;
+    std::vector<BLAS> meshes;
+    // in TLAS leaf order, indexed by HitRecord::instance_id
+    std::vector<Instance> instances;
+    std::vector<LBVHNode> TLAS;
+
+    // per-thread counters, padded to a cache line to avoid false sharing
+    struct alignas(64) RayCounter {
+        unsigned long long count{0};
+        unsigned long long occlusion_count{0};
+    };
+    mutable std::vector<RayCounter> ray_counters;
 };
 
 void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene);
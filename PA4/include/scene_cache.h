@@ -0,0 +1,43 @@
+#ifndef SCENE_CACHE_H_
+#define SCENE_CACHE_H_
+
+#include "core.h"
+#include "config.h"
+#include "geometry.h"
+#include "instance.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// What initSceneFromConfig builds from the objects and square lights of a config, everything but
+/// the lights themselves. A scene cache file holds one of these.
+struct SceneGeometry {
+    std::vector<BLAS> meshes;
+    std::vector<Instance> instances;
+    // world space triangle and radiance of every triangle light. they follow the square lights of
+    // the config in the light list, in this order.
+    std::vector<Triangle> light_triangles;
+    std::vector<Vec3f> light_radiance;
+    // see Scene::setLights
+    std::vector<int> prim_lights;
+};
+
+/// Hash of everything the geometry of config is built from: the objects, square lights, material
+/// names and emission, builder settings, and the size and modification time of each obj file.
+uint64_t sceneCacheKey(const Config &config);
+
+/// cache file of the scene with key in cache_dir
+std::string sceneCachePath(const std::string &cache_dir, uint64_t key);
+
+/// Map the cache file at path and read its geometry. False, leaving geometry unchanged, when the file
+/// is missing, was written for another key or format version, is truncated or holds indices out of
+/// range. square_light_count lights of the config come before the triangle lights of the cache,
+/// material ids index a table of material_count materials.
+bool loadSceneCache(const std::string &path, uint64_t key, int square_light_count, int material_count,
+                    SceneGeometry &geometry);
+
+/// write geometry to the cache file at path, replacing it as a whole. false if it cannot be written.
+bool saveSceneCache(const std::string &path, uint64_t key, const SceneGeometry &geometry);
+
+#endif //SCENE_CACHE_H_
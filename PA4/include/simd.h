@@ -0,0 +1,229 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RENDERER_X86 1
+#include <immintrin.h>
+#elif defined(RENDERER_AVX2)
+#error "RENDERER_AVX2 requires an x86-64 target"
+#endif
+
+// The bundled Eigen only ships its SSE kernels, so the renderer cannot be compiled with -mavx2.
+// With RENDERER_AVX2 the 8-wide operations and the kernels using them are compiled for AVX2
+// one function at a time instead.
+#if defined(RENDERER_AVX2) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET __attribute__((target("avx2,fma")))
+#else
+#define SIMD_TARGET
+#endif
+
+/// whether the CPU running the program can execute the SIMD_TARGET kernels
+inline bool simdTargetSupported() {
+#if defined(RENDERER_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return true;
+#endif
+}
+
+/// Thin wrappers over SSE / AVX registers, so kernels can be written once for every width.
+/// 8-wide vectors fall back to pairs of SSE registers when AVX2 is not enabled, and 4-wide
+/// vectors to plain arrays on targets other than x86-64.
+/// Kernels using FloatN<8> must be marked SIMD_TARGET.
+template<int N>
+struct FloatN;
+
+#ifdef RENDERER_X86
+
+template<>
+struct FloatN<4> {
+    __m128 v;
+
+    FloatN() = default;
+
+    FloatN(__m128 v) : v(v) {}
+
+    explicit FloatN(float s) : v(_mm_set1_ps(s)) {}
+
+    static FloatN load(const float *p) { return _mm_load_ps(p); }
+
+    /// convert N unsigned bytes to floats
+    static FloatN loadBytes(const uint8_t *p) {
+        int bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        __m128i zero = _mm_setzero_si128();
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+    }
+
+    void store(float *p) const { _mm_store_ps(p, v); }
+
+    friend FloatN operator+(FloatN a, FloatN b) { return _mm_add_ps(a.v, b.v); }
+
+    friend FloatN operator-(FloatN a, FloatN b) { return _mm_sub_ps(a.v, b.v); }
+
+    friend FloatN operator*(FloatN a, FloatN b) { return _mm_mul_ps(a.v, b.v); }
+
+    friend FloatN operator/(FloatN a, FloatN b) { return _mm_div_ps(a.v, b.v); }
+
+    friend FloatN min(FloatN a, FloatN b) { return _mm_min_ps(a.v, b.v); }
+
+    friend FloatN max(FloatN a, FloatN b) { return _mm_max_ps(a.v, b.v); }
+
+    /// bit i is set when lane i of a <= b
+    friend int lessEqualMask(FloatN a, FloatN b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+
+    /// bit i is set when lane i of a < b
+    friend int lessMask(FloatN a, FloatN b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+};
+
+#else
+
+template<>
+struct FloatN<4> {
+    float v[4];
+
+    FloatN() = default;
+
+    explicit FloatN(float s) : v{s, s, s, s} {}
+
+    static FloatN load(const float *p) {
+        FloatN r;
+        std::memcpy(r.v, p, sizeof(r.v));
+        return r;
+    }
+
+    /// convert N unsigned bytes to floats
+    static FloatN loadBytes(const uint8_t *p) {
+        FloatN r;
+        for (int i = 0; i < 4; ++i) r.v[i] = (float) p[i];
+        return r;
+    }
+
+    void store(float *p) const { std::memcpy(p, v, sizeof(v)); }
+
+    template<typename Op>
+    static FloatN apply(FloatN a, FloatN b, Op op) {
+        FloatN r;
+        for (int i = 0; i < 4; ++i) r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    friend FloatN operator+(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+
+    friend FloatN operator-(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+
+    friend FloatN operator*(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+
+    friend FloatN operator/(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+
+    // same operand order as minps / maxps, the second operand is returned when either is NaN
+    friend FloatN min(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+
+    friend FloatN max(FloatN a, FloatN b) { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+
+    /// bit i is set when lane i of a <= b
+    friend int lessEqualMask(FloatN a, FloatN b) {
+        int mask = 0;
+        for (int i = 0; i < 4; ++i) mask |= (a.v[i] <= b.v[i]) << i;
+        return mask;
+    }
+
+    /// bit i is set when lane i of a < b
+    friend int lessMask(FloatN a, FloatN b) {
+        int mask = 0;
+        for (int i = 0; i < 4; ++i) mask |= (a.v[i] < b.v[i]) << i;
+        return mask;
+    }
+};
+
+#endif
+
+#ifdef RENDERER_AVX2
+
+template<>
+struct FloatN<8> {
+    __m256 v;
+
+    FloatN() = default;
+
+    SIMD_TARGET FloatN(__m256 v) : v(v) {}
+
+    SIMD_TARGET explicit FloatN(float s) : v(_mm256_set1_ps(s)) {}
+
+    SIMD_TARGET static FloatN load(const float *p) { return _mm256_load_ps(p); }
+
+    SIMD_TARGET static FloatN loadBytes(const uint8_t *p) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    }
+
+    SIMD_TARGET void store(float *p) const { _mm256_store_ps(p, v); }
+
+    SIMD_TARGET friend FloatN operator+(FloatN a, FloatN b) { return _mm256_add_ps(a.v, b.v); }
+
+    SIMD_TARGET friend FloatN operator-(FloatN a, FloatN b) { return _mm256_sub_ps(a.v, b.v); }
+
+    SIMD_TARGET friend FloatN operator*(FloatN a, FloatN b) { return _mm256_mul_ps(a.v, b.v); }
+
+    SIMD_TARGET friend FloatN operator/(FloatN a, FloatN b) { return _mm256_div_ps(a.v, b.v); }
+
+    SIMD_TARGET friend FloatN min(FloatN a, FloatN b) { return _mm256_min_ps(a.v, b.v); }
+
+    SIMD_TARGET friend FloatN max(FloatN a, FloatN b) { return _mm256_max_ps(a.v, b.v); }
+
+    SIMD_TARGET friend int lessEqualMask(FloatN a, FloatN b) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+    }
+
+    SIMD_TARGET friend int lessMask(FloatN a, FloatN b) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ));
+    }
+};
+
+#else
+
+template<>
+struct FloatN<8> {
+    FloatN<4> lo, hi;
+
+    FloatN() = default;
+
+    FloatN(FloatN<4> lo, FloatN<4> hi) : lo(lo), hi(hi) {}
+
+    explicit FloatN(float s) : lo(s), hi(s) {}
+
+    static FloatN load(const float *p) { return {FloatN<4>::load(p), FloatN<4>::load(p + 4)}; }
+
+    static FloatN loadBytes(const uint8_t *p) { return {FloatN<4>::loadBytes(p), FloatN<4>::loadBytes(p + 4)}; }
+
+    void store(float *p) const {
+        lo.store(p);
+        hi.store(p + 4);
+    }
+
+    friend FloatN operator+(FloatN a, FloatN b) { return {a.lo + b.lo, a.hi + b.hi}; }
+
+    friend FloatN operator-(FloatN a, FloatN b) { return {a.lo - b.lo, a.hi - b.hi}; }
+
+    friend FloatN operator*(FloatN a, FloatN b) { return {a.lo * b.lo, a.hi * b.hi}; }
+
+    friend FloatN operator/(FloatN a, FloatN b) { return {a.lo / b.lo, a.hi / b.hi}; }
+
+    friend FloatN min(FloatN a, FloatN b) { return {min(a.lo, b.lo), min(a.hi, b.hi)}; }
+
+    friend FloatN max(FloatN a, FloatN b) { return {max(a.lo, b.lo), max(a.hi, b.hi)}; }
+
+    friend int lessEqualMask(FloatN a, FloatN b) {
+        return lessEqualMask(a.lo, b.lo) | (lessEqualMask(a.hi, b.hi) << 4);
+    }
+
+    friend int lessMask(FloatN a, FloatN b) { return lessMask(a.lo, b.lo) | (lessMask(a.hi, b.hi) << 4); }
+};
+
+#endif
+
+#endif //SIMD_H_
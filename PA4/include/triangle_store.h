@@ -0,0 +1,188 @@
+#ifndef TRIANGLE_STORE_H_
+#define TRIANGLE_STORE_H_
+
+#include "core.h"
+#include "ray.h"
+#include "geometry.h"
+#include "interaction.h"
+#include "simd.h"
+#include "ray_packet.h"
+
+#include <vector>
+
+class BinaryWriter;
+class BinaryReader;
+
+// one block holds as many triangles as a SIMD register has lanes
+#ifdef RENDERER_AVX2
+constexpr int TRIANGLE_BLOCK_SIZE = 8;
+#else
+constexpr int TRIANGLE_BLOCK_SIZE = 4;
+#endif
+
+/// N triangles in SoA form, stored as their first vertex and the two edges leaving it
+template<int N>
+struct alignas(32) TriangleBlock {
+    float v0[3][N];
+    float edge1[3][N];
+    float edge2[3][N];
+
+    /// Moller-Trumbore test of all lanes at once, records the closest hit in [ray.t_min, hit.t].
+    /// lane i is triangle first_prim + i; padding lanes have zero edges and fail the determinant test.
+    SIMD_TARGET bool intersect(const TraversalRay &ray, HitRecord &hit, int first_prim) const {
+        FloatN<N> t, u, v;
+        int mask = intersectLanes(ray, t, u, v) & lessEqualMask(t, FloatN<N>(hit.t));
+        if (mask == 0) return false;
+        alignas(32) float t_lanes[N], u_lanes[N], v_lanes[N];
+        t.store(t_lanes);
+        u.store(u_lanes);
+        v.store(v_lanes);
+        int best = __builtin_ctz(mask);
+        for (mask &= mask - 1; mask != 0; mask &= mask - 1) {
+            int lane = __builtin_ctz(mask);
+            if (t_lanes[lane] < t_lanes[best]) best = lane;
+        }
+        hit.t = t_lanes[best];
+        hit.prim_id = first_prim + best;
+        hit.u = u_lanes[best];
+        hit.v = v_lanes[best];
+        return true;
+    }
+
+    /// whether any lane is hit in [ray.t_min, ray.t_max)
+    SIMD_TARGET bool occluded(const TraversalRay &ray) const {
+        FloatN<N> t, u, v;
+        return (intersectLanes(ray, t, u, v) & lessMask(t, FloatN<N>(ray.t_max))) != 0;
+    }
+
+private:
+    /// mask of the lanes hit beyond ray.t_min, with their distances and barycentrics
+    SIMD_TARGET int intersectLanes(const TraversalRay &ray, FloatN<N> &t, FloatN<N> &u, FloatN<N> &v) const {
+        const FloatN<N> zero(0.0f), one(1.0f);
+        const FloatN<N> dir[3] = {FloatN<N>(ray.direction.x()), FloatN<N>(ray.direction.y()),
+                                  FloatN<N>(ray.direction.z())};
+        const FloatN<N> e1[3] = {FloatN<N>::load(edge1[0]), FloatN<N>::load(edge1[1]), FloatN<N>::load(edge1[2])};
+        const FloatN<N> e2[3] = {FloatN<N>::load(edge2[0]), FloatN<N>::load(edge2[1]), FloatN<N>::load(edge2[2])};
+        // pvec = dir x e2
+        FloatN<N> p0 = dir[1] * e2[2] - dir[2] * e2[1];
+        FloatN<N> p1 = dir[2] * e2[0] - dir[0] * e2[2];
+        FloatN<N> p2 = dir[0] * e2[1] - dir[1] * e2[0];
+        FloatN<N> det = e1[0] * p0 + e1[1] * p1 + e1[2] * p2;
+        FloatN<N> inv_det = one / det;
+        FloatN<N> s0 = FloatN<N>(ray.origin.x()) - FloatN<N>::load(v0[0]);
+        FloatN<N> s1 = FloatN<N>(ray.origin.y()) - FloatN<N>::load(v0[1]);
+        FloatN<N> s2 = FloatN<N>(ray.origin.z()) - FloatN<N>::load(v0[2]);
+        u = (s0 * p0 + s1 * p1 + s2 * p2) * inv_det;
+        // qvec = s x e1
+        FloatN<N> q0 = s1 * e1[2] - s2 * e1[1];
+        FloatN<N> q1 = s2 * e1[0] - s0 * e1[2];
+        FloatN<N> q2 = s0 * e1[1] - s1 * e1[0];
+        v = (dir[0] * q0 + dir[1] * q1 + dir[2] * q2) * inv_det;
+        t = (e2[0] * q0 + e2[1] * q1 + e2[2] * q2) * inv_det;
+        return (lessMask(zero, det) | lessMask(det, zero))
+               & lessEqualMask(zero, u) & lessEqualMask(zero, v) & lessEqualMask(u + v, one)
+               & lessEqualMask(FloatN<N>(ray.t_min), t);
+    }
+};
+
+/// Triangles of a mesh packed for traversal. Positions live in SoA blocks of consecutive triangles;
+/// shading normals and material ids sit in separate arrays read only for the final hit.
+class TriangleStore {
+public:
+    TriangleStore() = default;
+
+    /// pack triangles in the order the BVH leaves refer to them
+    void build(const std::vector<Triangle> &triangles);
+
+    /// Closest hit among the triangles [begin, end] of one leaf, hit.t bounds the search on entry.
+    /// The whole blocks covering the range are tested, a hit on a neighbouring triangle is still a
+    /// valid hit of the scene.
+    SIMD_TARGET bool intersectLeaf(const TraversalRay &ray, int begin, int end, HitRecord &hit) const {
+        bool found = false;
+        for (int i = begin / TRIANGLE_BLOCK_SIZE; i <= end / TRIANGLE_BLOCK_SIZE; ++i) {
+            found |= blocks[i].intersect(ray, hit, i * TRIANGLE_BLOCK_SIZE);
+        }
+        return found;
+    }
+
+    /// whether any triangle of the blocks covering [begin, end] is hit in [ray.t_min, ray.t_max)
+    SIMD_TARGET bool occludedLeaf(const TraversalRay &ray, int begin, int end) const {
+        for (int i = begin / TRIANGLE_BLOCK_SIZE; i <= end / TRIANGLE_BLOCK_SIZE; ++i) {
+            if (blocks[i].occluded(ray)) return true;
+        }
+        return false;
+    }
+
+    /// Closest hits of the packet rays in active (one bit per ray) with the triangles [begin, end].
+    /// Each triangle is broadcast and tested against the SIMD groups holding active rays.
+    SIMD_TARGET void intersectPacket(RayPacket &packet, int begin, int end, uint64_t active) const {
+        using Float = FloatN<PACKET_LANES>;
+        const Float zero(0.0f), one(1.0f), t_min(packet.t_min);
+        for (int prim_id = begin; prim_id <= end; ++prim_id) {
+            const auto &block = blocks[prim_id / TRIANGLE_BLOCK_SIZE];
+            int lane = prim_id % TRIANGLE_BLOCK_SIZE;
+            const Float e1[3] = {Float(block.edge1[0][lane]), Float(block.edge1[1][lane]), Float(block.edge1[2][lane])};
+            const Float e2[3] = {Float(block.edge2[0][lane]), Float(block.edge2[1][lane]), Float(block.edge2[2][lane])};
+            const Float v0[3] = {Float(block.v0[0][lane]), Float(block.v0[1][lane]), Float(block.v0[2][lane])};
+            for (int group = 0; group < PACKET_SIZE; group += PACKET_LANES) {
+                if (((active >> group) & ((1u << PACKET_LANES) - 1)) == 0) continue;
+                const Float dir[3] = {Float::load(packet.direction[0] + group), Float::load(packet.direction[1] + group),
+                                      Float::load(packet.direction[2] + group)};
+                Float p0 = dir[1] * e2[2] - dir[2] * e2[1];
+                Float p1 = dir[2] * e2[0] - dir[0] * e2[2];
+                Float p2 = dir[0] * e2[1] - dir[1] * e2[0];
+                Float det = e1[0] * p0 + e1[1] * p1 + e1[2] * p2;
+                Float inv_det = one / det;
+                Float s0 = Float::load(packet.origin[0] + group) - v0[0];
+                Float s1 = Float::load(packet.origin[1] + group) - v0[1];
+                Float s2 = Float::load(packet.origin[2] + group) - v0[2];
+                Float u = (s0 * p0 + s1 * p1 + s2 * p2) * inv_det;
+                Float q0 = s1 * e1[2] - s2 * e1[1];
+                Float q1 = s2 * e1[0] - s0 * e1[2];
+                Float q2 = s0 * e1[1] - s1 * e1[0];
+                Float v = (dir[0] * q0 + dir[1] * q1 + dir[2] * q2) * inv_det;
+                Float t = (e2[0] * q0 + e2[1] * q1 + e2[2] * q2) * inv_det;
+                int mask = (lessMask(zero, det) | lessMask(det, zero))
+                           & lessEqualMask(zero, u) & lessEqualMask(zero, v) & lessEqualMask(u + v, one)
+                           & lessEqualMask(t_min, t) & lessEqualMask(t, Float::load(packet.t_max + group));
+                if (mask == 0) continue;
+                alignas(32) float t_lanes[PACKET_LANES], u_lanes[PACKET_LANES], v_lanes[PACKET_LANES];
+                t.store(t_lanes);
+                u.store(u_lanes);
+                v.store(v_lanes);
+                for (; mask != 0; mask &= mask - 1) {
+                    int i = __builtin_ctz(mask);
+                    packet.t_max[group + i] = t_lanes[i];
+                    packet.prim_id[group + i] = prim_id;
+                    packet.u[group + i] = u_lanes[i];
+                    packet.v[group + i] = v_lanes[i];
+                }
+            }
+        }
+    }
+
+    /// interpolate the surface attributes of a hit, the position lies along ray and the normal is in
+    /// the space of the triangles. the material is left to the caller.
+    void fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const;
+
+    [[nodiscard]] int getMaterialId(int prim_id) const { return material_ids[prim_id]; }
+
+    [[nodiscard]] size_t size() const { return material_ids.size(); }
+
+    /// total size in bytes of the packed blocks and attribute arrays
+    [[nodiscard]] size_t getMemorySize() const;
+
+    void write(BinaryWriter &writer) const;
+
+    /// read what write stored, false when the data is truncated, inconsistent or has material ids
+    /// outside [0, material_count)
+    bool read(BinaryReader &reader, int material_count);
+
+private:
+    std::vector<TriangleBlock<TRIANGLE_BLOCK_SIZE>> blocks;
+    // three vertex normals per triangle
+    std::vector<Vec3f> normals;
+    std::vector<int> material_ids;
+};
+
+#endif //TRIANGLE_STORE_H_
@@ -3,7 +3,7 @@
 
 #include "core.h"
 
-#include <random>
+#include <utility>
 
 namespace utils {
 
@@ -27,6 +27,25 @@ namespace utils {
         return tmp;
     }
 
+    /// MIS weight of a sample drawn with density f_pdf, against one other strategy with density g_pdf
+    static inline float powerHeuristic(float f_pdf, float g_pdf) {
+        return f_pdf * f_pdf / (f_pdf * f_pdf + g_pdf * g_pdf);
+    }
+
+    /// Tangents t and b completing the unit vector n to a right-handed orthonormal basis, branchless
+    /// (Duff et al., Building an Orthonormal Basis, Revisited)
+    static inline void coordinateSystem(const Vec3f &n, Vec3f &t, Vec3f &b) {
+        float sign = std::copysign(1.0f, n.z());
+        float a = -1 / (sign + n.z());
+        float c = n.x() * n.y() * a;
+        t = Vec3f(1 + sign * n.x() * n.x() * a, sign * c, -sign * n.x());
+        b = Vec3f(c, sign + n.y() * n.y() * a, -n.y());
+    }
+
+    static inline float luminance(const Vec3f &rgb) {
+        return 0.2126f * rgb.x() + 0.7152f * rgb.y() + 0.0722f * rgb.z();
+    }
+
     static inline unsigned int expandBits(unsigned int v) {
         v = (v * 0x00010001u) & 0xFF0000FFu;
         v = (v * 0x00000101u) & 0x0F00F00Fu;
@@ -47,22 +66,37 @@ namespace utils {
         unsigned int zz = expandBits((unsigned int) z);
         return (xx << 2) + (yy << 1) + zz;
     }
-}
 
-class Sampler {
-public:
-    Sampler() = default;
-
-    float get1D() { return dis(engine); }
-
-    Vec2f get2D() { return {dis(engine), dis(engine)}; }
-
-    void setSeed(int i) { engine.seed(i); }
-
-private:
-    std::default_random_engine engine;
-    std::uniform_real_distribution<float> dis;
-};
+    /// interleave the lower 16 bits of x and y, x takes the even bits
+    static inline unsigned int morton2D(unsigned int x, unsigned int y) {
+        auto spread = [](unsigned int v) {
+            v &= 0x0000FFFFu;
+            v = (v | (v << 8)) & 0x00FF00FFu;
+            v = (v | (v << 4)) & 0x0F0F0F0Fu;
+            v = (v | (v << 2)) & 0x33333333u;
+            v = (v | (v << 1)) & 0x55555555u;
+            return v;
+        };
+        return spread(x) | spread(y) << 1;
+    }
 
+    /// distance of (x, y) along the Hilbert curve over an n x n grid, n a power of two
+    static inline unsigned int hilbert2D(unsigned int n, unsigned int x, unsigned int y) {
+        unsigned int d = 0;
+        for (unsigned int s = n / 2; s > 0; s /= 2) {
+            unsigned int rx = (x & s) > 0, ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            // rotate the quadrant so the sub-curve starts and ends at the right corners
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = n - 1 - x;
+                    y = n - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+}
 
 #endif //UTILS_H_
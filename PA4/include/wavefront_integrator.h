@@ -0,0 +1,77 @@
+#ifndef WAVEFRONT_INTEGRATOR_H_
+#define WAVEFRONT_INTEGRATOR_H_
+
+#include "integrator.h"
+
+#include <vector>
+
+/// Breadth-first path tracer. A wave of paths is advanced one bounce at a time: every stage
+/// (intersection, shading, shadow rays) runs as one parallel kernel over a queue of paths, and
+/// terminated paths are compacted out of the queue before the next bounce.
+class WavefrontIntegrator : public Integrator {
+public:
+    WavefrontIntegrator(std::shared_ptr<Camera> cam,
+                        std::shared_ptr<Scene> scene, int spp, int max_depth,
+                        const Config::RenderConfig &render_config = {});
+
+    void render() const override;
+
+private:
+    /// SoA state of the paths in flight, indexed by queue slot
+    struct PathQueue {
+        std::vector<Vec3f> origin;
+        std::vector<Vec3f> direction;
+        std::vector<Vec3f> beta;
+        // pdf of the BSDF sample that produced the ray, 0 for camera rays and after delta bounces
+        std::vector<float> bsdf_pdf;
+        // normal where the ray left, for the light selection pdf
+        std::vector<Vec3f> normal;
+        // index of the path within the wave, its radiance is accumulated there
+        std::vector<int> path_id;
+        // next sampler dimension of the path's pixel sample
+        std::vector<int> dimension;
+        std::vector<Interaction> hit;
+
+        [[nodiscard]] int size() const { return (int) path_id.size(); }
+
+        void resize(int n);
+    };
+
+    /// shadow rays queued by the shading stage, one slot per path slot
+    struct ShadowQueue {
+        std::vector<Vec3f> origin;
+        std::vector<Vec3f> direction;
+        std::vector<float> t_max;
+        // radiance added to the path if the shadow ray is unoccluded
+        std::vector<Vec3f> contribution;
+
+        void resize(int n);
+    };
+
+    void generateCameraRays(int first_pixel, int samples_per_pixel, std::vector<std::unique_ptr<Sampler>> &samplers,
+                            PathQueue &paths) const;
+
+    /// order the slots of continuing paths by direction octant, then origin Morton code
+    void sortSlots(const PathQueue &paths, std::vector<int> &slots) const;
+
+    void intersect(PathQueue &paths) const;
+
+    /// all slots, the hits without a BSDF (misses and emitters) first and then the hits of each
+    /// material type, in queue order within a group
+    void groupByMaterial(const PathQueue &paths, std::vector<int> &slots) const;
+
+    /// Shade the hits of slots, in that order. first_pixel is the pixel of path_id 0, paths continue
+    /// the sample of their own pixel.
+    void shade(PathQueue &paths, const std::vector<int> &slots, int depth, int first_pixel,
+               std::vector<std::unique_ptr<Sampler>> &samplers, ShadowQueue &shadows,
+               std::vector<char> &has_shadow, std::vector<char> &alive, std::vector<Vec3f> &path_radiance) const;
+
+    void traceShadowRays(const PathQueue &paths, const ShadowQueue &shadows, const std::vector<int> &slots,
+                         std::vector<Vec3f> &path_radiance) const;
+
+    int wavefront_size;
+    bool sort_rays;
+    bool group_materials;
+};
+
+#endif //WAVEFRONT_INTEGRATOR_H_
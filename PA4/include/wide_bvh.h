@@ -0,0 +1,314 @@
+#ifndef WIDE_BVH_H_
+#define WIDE_BVH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "accel.h"
+#include "interaction.h"
+#include "simd.h"
+
+/// ray constants broadcast to all lanes of a wide node test
+template<int N>
+struct WideRay {
+    FloatN<N> origin[3];
+    FloatN<N> inv_direction[3];
+    FloatN<N> t_min;
+    const int *sign;
+
+    SIMD_TARGET explicit WideRay(const TraversalRay &ray)
+            : origin{FloatN<N>(ray.origin.x()), FloatN<N>(ray.origin.y()), FloatN<N>(ray.origin.z())},
+              inv_direction{FloatN<N>(ray.inv_direction.x()), FloatN<N>(ray.inv_direction.y()),
+                            FloatN<N>(ray.inv_direction.z())},
+              t_min(ray.t_min), sign(ray.sign) {}
+};
+
+/// node of an N-ary BVH. Child bounds are kept in SoA form so all children are slab-tested at once.
+template<int N>
+struct alignas(32) WideBVHNode {
+    float bounds_min[3][N];
+    float bounds_max[3][N];
+    // inner child: index of the child node, leaf child: first triangle, empty slot: -1
+    int child[N];
+    // number of triangles for leaf children, 0 for inner children
+    int count[N];
+
+    WideBVHNode() = default;
+
+    /// store the bounds of the first child_num children, the other slots get inverted bounds and are never hit
+    WideBVHNode(const AABB *child_bounds, int child_num) : child{}, count{} {
+        for (int lane = 0; lane < N; ++lane) {
+            for (int axis = 0; axis < 3; ++axis) {
+                bounds_min[axis][lane] = lane < child_num ? child_bounds[lane].low_bnd[axis]
+                                                          : std::numeric_limits<float>::infinity();
+                bounds_max[axis][lane] = lane < child_num ? child_bounds[lane].upper_bnd[axis]
+                                                          : -std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+
+    /// slab test against all children, returns the mask of hit lanes and their entrance distances
+    SIMD_TARGET int intersect(const WideRay<N> &ray, FloatN<N> t_max, FloatN<N> &t_in) const {
+        FloatN<N> t_out = t_max;
+        t_in = ray.t_min;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float *near = ray.sign[axis] ? bounds_max[axis] : bounds_min[axis];
+            const float *far = ray.sign[axis] ? bounds_min[axis] : bounds_max[axis];
+            t_in = max(t_in, (FloatN<N>::load(near) - ray.origin[axis]) * ray.inv_direction[axis]);
+            t_out = min(t_out, (FloatN<N>::load(far) - ray.origin[axis]) * ray.inv_direction[axis]);
+        }
+        return lessEqualMask(t_in, t_out);
+    }
+};
+
+/// Compressed node of an N-ary BVH. Child bounds are quantized to 8 bits on a per-axis grid spanning
+/// the node's own bounds; the grid spacing is a power of two and the quantized boxes always enclose
+/// the exact ones, so decoding only costs an int-to-float conversion and a multiply-add per plane.
+template<int N>
+struct alignas(16) QuantizedWideBVHNode {
+    float origin[3];
+    float scale[3];
+    uint8_t q_min[3][N];
+    uint8_t q_max[3][N];
+    int child[N];
+    uint8_t count[N];
+
+    QuantizedWideBVHNode() = default;
+
+    QuantizedWideBVHNode(const AABB *child_bounds, int child_num) : child{}, count{} {
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = std::numeric_limits<float>::infinity(), high = -low;
+            for (int lane = 0; lane < child_num; ++lane) {
+                low = std::min(low, child_bounds[lane].low_bnd[axis]);
+                high = std::max(high, child_bounds[lane].upper_bnd[axis]);
+            }
+            // smallest power of two that covers the extent in 255 steps, never zero
+            int exponent;
+            std::frexp(std::max((high - low) / 255.0f, std::numeric_limits<float>::min()), &exponent);
+            origin[axis] = low;
+            scale[axis] = std::ldexp(1.0f, exponent);
+            for (int lane = 0; lane < N; ++lane) {
+                if (lane >= child_num) {
+                    // inverted on every axis, never hit
+                    q_min[axis][lane] = 255;
+                    q_max[axis][lane] = 0;
+                    continue;
+                }
+                q_min[axis][lane] = quantize(child_bounds[lane].low_bnd[axis], axis, false);
+                q_max[axis][lane] = quantize(child_bounds[lane].upper_bnd[axis], axis, true);
+            }
+        }
+    }
+
+    SIMD_TARGET int intersect(const WideRay<N> &ray, FloatN<N> t_max, FloatN<N> &t_in) const {
+        FloatN<N> t_out = t_max;
+        t_in = ray.t_min;
+        for (int axis = 0; axis < 3; ++axis) {
+            const uint8_t *near = ray.sign[axis] ? q_max[axis] : q_min[axis];
+            const uint8_t *far = ray.sign[axis] ? q_min[axis] : q_max[axis];
+            // decoded plane - ray origin, with the node origin folded into the ray origin
+            FloatN<N> offset = FloatN<N>(origin[axis]) - ray.origin[axis];
+            FloatN<N> step = FloatN<N>(scale[axis]) * ray.inv_direction[axis];
+            t_in = max(t_in, offset * ray.inv_direction[axis] + FloatN<N>::loadBytes(near) * step);
+            t_out = min(t_out, offset * ray.inv_direction[axis] + FloatN<N>::loadBytes(far) * step);
+        }
+        return lessEqualMask(t_in, t_out);
+    }
+
+private:
+    [[nodiscard]] float decode(int q, int axis) const { return origin[axis] + (float) q * scale[axis]; }
+
+    /// round outwards, then step once more if the decoded value still falls inside the exact bound
+    [[nodiscard]] uint8_t quantize(float value, int axis, bool round_up) const {
+        float cell = (value - origin[axis]) / scale[axis];
+        int q = std::clamp((int) (round_up ? std::ceil(cell) : std::floor(cell)), 0, 255);
+        if (round_up && q < 255 && decode(q, axis) < value) ++q;
+        if (!round_up && q > 0 && decode(q, axis) > value) --q;
+        return (uint8_t) q;
+    }
+};
+
+/// N-ary BVH collapsed from the binary LBVH, N is 4 (SSE) or 8 (AVX).
+/// Node is WideBVHNode<N> or its compressed variant QuantizedWideBVHNode<N>.
+template<int N, typename Node = WideBVHNode<N>>
+class WideBVH {
+public:
+    WideBVH() = default;
+
+    /// collapse a flattened binary BVH, the leaf ranges are kept as they are
+    void build(const std::vector<LBVHNode> &binary) {
+        nodes.clear();
+        if (!binary.empty()) collapse(binary, 0);
+    }
+
+    [[nodiscard]] const std::vector<Node> &getNodes() const { return nodes; }
+
+    /// nodes of an earlier build, as getNodes returned them
+    void setNodes(std::vector<Node> new_nodes) { nodes = std::move(new_nodes); }
+
+    /// Whether the nodes can be traversed safely over triangle_count triangles: leaf ranges lie within
+    /// them, inner children come after their parent and the tree is at most BVH_MAX_DEPTH levels deep.
+    [[nodiscard]] bool isValid(int triangle_count) const {
+        std::vector<int> depths(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (int lane = 0; lane < N; ++lane) {
+                int child = nodes[i].child[lane], count = nodes[i].count[lane];
+                if (child == -1) continue;
+                if (count > 0) {
+                    if (child < 0 || child > triangle_count - count) return false;
+                } else {
+                    if (child <= (int) i || child >= (int) nodes.size() || depths[i] >= BVH_MAX_DEPTH) return false;
+                    depths[child] = depths[i] + 1;
+                }
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] size_t getMemorySize() const { return nodes.size() * sizeof(Node); }
+
+    /// Ordered closest-hit traversal. leaf_test(begin, end, hit) tests the inclusive triangle range
+    /// and returns whether hit was updated; hit.t bounds the search on entry.
+    template<typename LeafTest>
+    SIMD_TARGET bool intersect(const TraversalRay &ray, HitRecord &hit, LeafTest &&leaf_test) const {
+        if (nodes.empty()) return false;
+        struct StackEntry {
+            int child;
+            int count;
+            float t_in;
+        };
+        // every level pushes at most N - 1 siblings
+        StackEntry stack[BVH_STACK_SIZE * (N - 1)];
+        int stack_size = 0;
+        const WideRay<N> wide_ray(ray);
+        bool found = false;
+        StackEntry current{0, 0, ray.t_min};
+        while (true) {
+            if (current.count > 0) {
+                found |= leaf_test(current.child, current.child + current.count - 1, hit);
+            } else {
+                const Node &node = nodes[current.child];
+                FloatN<N> t_in;
+                int mask = node.intersect(wide_ray, FloatN<N>(hit.t), t_in);
+                if (mask != 0) {
+                    alignas(32) float t_lanes[N];
+                    t_in.store(t_lanes);
+                    // sort the hit children by entrance distance, farthest first
+                    StackEntry hits[N];
+                    int hit_num = 0;
+                    for (; mask != 0; mask &= mask - 1) {
+                        int lane = __builtin_ctz(mask);
+                        StackEntry entry{node.child[lane], node.count[lane], t_lanes[lane]};
+                        int j = hit_num++;
+                        for (; j > 0 && hits[j - 1].t_in < entry.t_in; --j) hits[j] = hits[j - 1];
+                        hits[j] = entry;
+                    }
+                    for (int i = 0; i < hit_num - 1; ++i) stack[stack_size++] = hits[i];
+                    current = hits[hit_num - 1];
+                    continue;
+                }
+            }
+            // pop the next node that may still hold a closer hit
+            do {
+                if (stack_size == 0) return found;
+                --stack_size;
+            } while (stack[stack_size].t_in > hit.t);
+            current = stack[stack_size];
+        }
+    }
+
+    /// Any-hit traversal for occlusion queries, stops at the first leaf for which
+    /// leaf_test(begin, end) returns true. Children are not sorted by distance; leaf children
+    /// are tested as soon as their parent is visited, before descending into inner children.
+    template<typename LeafTest>
+    SIMD_TARGET bool occluded(const TraversalRay &ray, LeafTest &&leaf_test) const {
+        if (nodes.empty()) return false;
+        int stack[BVH_STACK_SIZE * (N - 1)];
+        int stack_size = 0;
+        const WideRay<N> wide_ray(ray);
+        const FloatN<N> t_max(ray.t_max);
+        int current = 0;
+        while (true) {
+            const Node &node = nodes[current];
+            FloatN<N> t_in;
+            int mask = node.intersect(wide_ray, t_max, t_in);
+            int next = -1;
+            for (; mask != 0; mask &= mask - 1) {
+                int lane = __builtin_ctz(mask);
+                if (node.count[lane] > 0) {
+                    if (leaf_test(node.child[lane], node.child[lane] + node.count[lane] - 1)) return true;
+                } else {
+                    if (next != -1) stack[stack_size++] = next;
+                    next = node.child[lane];
+                }
+            }
+            if (next != -1) {
+                current = next;
+            } else if (stack_size > 0) {
+                current = stack[--stack_size];
+            } else {
+                return false;
+            }
+        }
+    }
+
+private:
+    int collapse(const std::vector<LBVHNode> &binary, int idx) {
+        int node_idx = (int) nodes.size();
+        nodes.emplace_back();
+        // open the largest inner child until all N slots are used
+        int children[N];
+        int child_num = 0;
+        if (binary[idx].triangle_begin_idx != -1) {
+            children[child_num++] = idx;
+        } else {
+            children[child_num++] = idx + 1;
+            children[child_num++] = binary[idx].right_idx;
+        }
+        while (child_num < N) {
+            int best = -1;
+            float best_area = -1;
+            for (int i = 0; i < child_num; ++i) {
+                const LBVHNode &candidate = binary[children[i]];
+                if (candidate.triangle_begin_idx == -1 && candidate.aabb.getSurfaceArea() > best_area) {
+                    best = i;
+                    best_area = candidate.aabb.getSurfaceArea();
+                }
+            }
+            if (best == -1) break;
+            int opened = children[best];
+            children[best] = opened + 1;
+            children[child_num++] = binary[opened].right_idx;
+        }
+
+        AABB child_bounds[N];
+        for (int lane = 0; lane < child_num; ++lane) child_bounds[lane] = binary[children[lane]].aabb;
+        Node node(child_bounds, child_num);
+        for (int lane = 0; lane < N; ++lane) {
+            if (lane >= child_num) {
+                node.child[lane] = -1;
+                continue;
+            }
+            const LBVHNode &child = binary[children[lane]];
+            if (child.triangle_begin_idx != -1) {
+                node.child[lane] = child.triangle_begin_idx;
+                node.count[lane] = child.triangle_end_idx - child.triangle_begin_idx + 1;
+            } else {
+                node.child[lane] = collapse(binary, children[lane]);
+            }
+        }
+        nodes[node_idx] = node;
+        return node_idx;
+    }
+
+    std::vector<Node> nodes;
+};
+
+template<int N>
+using QuantizedWideBVH = WideBVH<N, QuantizedWideBVHNode<N>>;
+
+#endif //WIDE_BVH_H_
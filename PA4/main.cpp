@@ -2,12 +2,20 @@
 #include <chrono>
 
 #include "integrator.h"
+#include "wavefront_integrator.h"
 #include "config_io.h"
 #include "config.h"
+#include "simd.h"
 
 #include <fstream>
+#include <omp.h>
 
 int main(int argc, char *argv[]) {
+    if (!simdTargetSupported()) {
+        std::cerr << "This build uses AVX2, which the CPU does not support. "
+                  << "Rebuild with -DRENDERER_ENABLE_AVX2=OFF. Exit." << std::endl;
+        exit(-1);
+    }
     /// load config from json file
     std::setbuf(stdout, nullptr);
     Config config;
@@ -36,6 +44,28 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
     std::cout << "Parsed json to config. Start building scene..." << std::endl;
+    if (config.render_config.integrator == IntegratorType::WAVEFRONT) {
+        // options of the tiled path integrator the wavefront integrator has no counterpart for
+        const Config::RenderConfig &render_config = config.render_config;
+        const Config::RenderConfig defaults;
+        std::string ignored;
+        auto check = [&ignored](bool changed, const char *key) {
+            if (changed) ignored += std::string(ignored.empty() ? "" : ", ") + key;
+        };
+        check(render_config.packet_tracing != defaults.packet_tracing, "packet_tracing");
+        check(render_config.tile_size != defaults.tile_size, "tile_size");
+        check(render_config.tile_order != defaults.tile_order, "tile_order");
+        check(render_config.pass_spp != defaults.pass_spp, "pass_spp");
+        check(render_config.time_budget != defaults.time_budget, "time_budget");
+        check(render_config.preview_interval != defaults.preview_interval, "preview_interval");
+        check(render_config.target_error != defaults.target_error, "target_error");
+        check(render_config.max_spp != defaults.max_spp, "max_spp");
+        check(render_config.russian_roulette_depth != defaults.russian_roulette_depth, "russian_roulette_depth");
+        if (!ignored.empty()) std::cerr << "Warning: the wavefront integrator ignores " << ignored << "." << std::endl;
+    }
+    // set before the scene is built, it sizes its per-thread state by the thread count
+    if (config.render_config.threads > 0) omp_set_num_threads(config.render_config.threads);
+    std::cout << "Using " << omp_get_max_threads() << " threads." << std::endl;
     // initialize all settings from config
     // set image resolution.
     std::shared_ptr<ImageRGB> rendered_img
@@ -48,8 +78,13 @@ int main(int argc, char *argv[]) {
     auto scene = std::make_shared<Scene>();
     initSceneFromConfig(config, scene);
     // init integrator
-    std::unique_ptr<Integrator> integrator
-            = std::make_unique<Integrator>(camera, scene, config.spp, config.max_depth);
+    std::unique_ptr<Integrator> integrator;
+    if (config.render_config.integrator == IntegratorType::WAVEFRONT) {
+        integrator = std::make_unique<WavefrontIntegrator>(camera, scene, config.spp, config.max_depth,
+                                                           config.render_config);
+    } else {
+        integrator = std::make_unique<Integrator>(camera, scene, config.spp, config.max_depth, config.render_config);
+    }
     std::cout << "Start Rendering..." << std::endl;
     auto start = std::chrono::steady_clock::now();
     // render scene
@@ -57,6 +92,9 @@ int main(int argc, char *argv[]) {
     auto end = std::chrono::steady_clock::now();
     auto time = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
     std::cout << "\nRender Finished in " << time << "s." << std::endl;
+    auto seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Traced " << scene->getRayCount() << " rays (" << scene->getOcclusionRayCount() << " shadow), "
+              << static_cast<double>(scene->getRayCount()) / seconds / 1e6 << " Mrays/s." << std::endl;
     rendered_img->writeImgToFile("../result.png");
     std::cout << "Image saved to disk." << std::endl;
     return 0;
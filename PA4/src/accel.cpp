@@ -1,5 +1,14 @@
 #include "accel.h"
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <numeric>
+
+#include <omp.h>
+
+#include "utils.h"
+
 AABB::AABB(const Vec3f &v1, const Vec3f &v2, const Vec3f &v3) {
     low_bnd = v1.cwiseMin(v2.cwiseMin(v3));
     upper_bnd = v1.cwiseMax(v2.cwiseMax(v3));
@@ -45,3 +54,564 @@ bool AABB::intersect(const Ray &ray, float *t_in, float *t_out) {
 
     return *t_out >= *t_in;
 }
+
+float AABB::getSurfaceArea() const {
+    Vec3f extent = (upper_bnd - low_bnd).cwiseMax(0.0f);
+    return 2 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+}
+
+namespace {
+    constexpr int SAH_BIN_COUNT = 16;
+    // ranges smaller than this are built / flattened on the current task
+    constexpr int BUILD_TASK_THRESHOLD = 4096;
+    constexpr int RADIX_BITS = 8;
+    constexpr int RADIX_BUCKETS = 1 << RADIX_BITS;
+    // below this depth the SAH builder splits at the median, which adds at most 31 more levels
+    constexpr int SAH_MEDIAN_SPLIT_DEPTH = BVH_MAX_DEPTH - 32;
+
+    const AABB EMPTY_AABB(Vec3f::Constant(1e30f), Vec3f::Constant(-1e30f));
+
+    /// intermediate node with explicit children, flattened into LBVHNode once the tree is complete.
+    /// leaf nodes have left == -1 and cover prim_order[begin, end).
+    /// flat_size is the number of LBVHNodes the subtree flattens into.
+    struct BuildNode {
+        AABB aabb;
+        int left{-1};
+        int right{-1};
+        int begin{0};
+        int end{0};
+        int flat_size{1};
+    };
+
+    void flattenRecursive(const std::vector<BuildNode> &nodes, int node_idx, int flat_idx,
+                          std::vector<LBVHNode> &flat) {
+        const BuildNode &node = nodes[node_idx];
+        flat[flat_idx].aabb = node.aabb;
+        if (node.left == -1) {
+            flat[flat_idx].triangle_begin_idx = node.begin;
+            flat[flat_idx].triangle_end_idx = node.end - 1;
+            return;
+        }
+        int left_flat = flat_idx + 1, right_flat = left_flat + nodes[node.left].flat_size;
+        flat[flat_idx].right_idx = right_flat;
+        int left = node.left, right = node.right;
+        if (node.flat_size > BUILD_TASK_THRESHOLD) {
+#pragma omp task default(none) shared(nodes, flat) firstprivate(left, left_flat)
+            flattenRecursive(nodes, left, left_flat, flat);
+            flattenRecursive(nodes, right, right_flat, flat);
+#pragma omp taskwait
+        } else {
+            flattenRecursive(nodes, left, left_flat, flat);
+            flattenRecursive(nodes, right, right_flat, flat);
+        }
+    }
+
+    /// write the build tree in depth-first order, left child directly after its parent
+    std::vector<LBVHNode> flattenBuildTree(const std::vector<BuildNode> &nodes, int root) {
+        std::vector<LBVHNode> flat(nodes[root].flat_size, LBVHNode(AABB()));
+#pragma omp parallel default(none) shared(nodes, root, flat)
+#pragma omp single
+        flattenRecursive(nodes, root, 0, flat);
+        return flat;
+    }
+
+    class BinnedSAHBuilder {
+    public:
+        BinnedSAHBuilder(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order)
+                : prim_bounds(prim_bounds), prim_order(prim_order) {
+            centroids.resize(prim_bounds.size());
+            for (int i = 0; i < (int) prim_bounds.size(); ++i) {
+                centroids[i] = prim_bounds[i].getCenter();
+            }
+            nodes.resize(2 * prim_bounds.size() - 1);
+        }
+
+        std::vector<LBVHNode> build() {
+            node_count = 1;
+#pragma omp parallel default(none)
+#pragma omp single
+            buildRecursive(0, 0, (int) prim_order.size(), 0);
+            return flattenBuildTree(nodes, 0);
+        }
+
+    private:
+        void buildRecursive(int node_idx, int begin, int end, int depth) {
+            AABB bounds = EMPTY_AABB, centroid_bounds = EMPTY_AABB;
+            for (int i = begin; i < end; ++i) {
+                bounds = AABB(bounds, prim_bounds[prim_order[i]]);
+                centroid_bounds = AABB(centroid_bounds, AABB(centroids[prim_order[i]], centroids[prim_order[i]]));
+            }
+            BuildNode &node = nodes[node_idx];
+            node.aabb = bounds;
+            node.begin = begin;
+            node.end = end;
+            int count = end - begin;
+            if (count == 1) return;
+            if (depth >= SAH_MEDIAN_SPLIT_DEPTH) {
+                // degenerate input drove the SAH this deep, halve the range to bound the depth
+                if (count <= BVH_MAX_LEAF_SIZE) return;
+                int axis = 0;
+                for (int a = 1; a < 3; ++a) {
+                    if (centroid_bounds.getDist(a) > centroid_bounds.getDist(axis)) axis = a;
+                }
+                int mid = (begin + end) / 2;
+                std::nth_element(prim_order.begin() + begin, prim_order.begin() + mid, prim_order.begin() + end,
+                                 [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+                split(node, begin, mid, end, depth);
+                return;
+            }
+
+            // evaluate the binned SAH on all three axes
+            int best_axis = -1, best_bin = -1;
+            float best_cost = std::numeric_limits<float>::max();
+            for (int axis = 0; axis < 3; ++axis) {
+                float extent = centroid_bounds.getDist(axis);
+                if (extent <= 0) continue;
+                AABB bin_bounds[SAH_BIN_COUNT];
+                int bin_count[SAH_BIN_COUNT] = {};
+                std::fill(bin_bounds, bin_bounds + SAH_BIN_COUNT, EMPTY_AABB);
+                for (int i = begin; i < end; ++i) {
+                    int b = binIndex(centroids[prim_order[i]][axis], centroid_bounds.low_bnd[axis], extent);
+                    bin_bounds[b] = AABB(bin_bounds[b], prim_bounds[prim_order[i]]);
+                    ++bin_count[b];
+                }
+                // sweep from the right to collect the cost of every right partition
+                float right_cost[SAH_BIN_COUNT];
+                AABB acc = EMPTY_AABB;
+                int acc_count = 0;
+                for (int b = SAH_BIN_COUNT - 1; b > 0; --b) {
+                    acc = AABB(acc, bin_bounds[b]);
+                    acc_count += bin_count[b];
+                    right_cost[b] = acc_count ? acc.getSurfaceArea() * (float) acc_count : 0;
+                }
+                acc = EMPTY_AABB;
+                acc_count = 0;
+                for (int b = 0; b < SAH_BIN_COUNT - 1; ++b) {
+                    acc = AABB(acc, bin_bounds[b]);
+                    acc_count += bin_count[b];
+                    if (acc_count == 0 || acc_count == count) continue;
+                    float cost = acc.getSurfaceArea() * (float) acc_count + right_cost[b + 1];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            float leaf_cost = SAH_INTERSECTION_COST * (float) count;
+            int mid;
+            if (best_axis == -1) {
+                // all centroids coincide, only the leaf size limit can force a split
+                if (count <= BVH_MAX_LEAF_SIZE) return;
+                mid = (begin + end) / 2;
+            } else {
+                best_cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * best_cost / bounds.getSurfaceArea();
+                if (count <= BVH_MAX_LEAF_SIZE && leaf_cost <= best_cost) return;
+                float low = centroid_bounds.low_bnd[best_axis], extent = centroid_bounds.getDist(best_axis);
+                mid = (int) (std::partition(prim_order.begin() + begin, prim_order.begin() + end, [&](int p) {
+                    return binIndex(centroids[p][best_axis], low, extent) <= best_bin;
+                }) - prim_order.begin());
+            }
+
+            split(node, begin, mid, end, depth);
+        }
+
+        void split(BuildNode &node, int begin, int mid, int end, int depth) {
+            int left = node_count.fetch_add(2);
+            node.left = left;
+            node.right = left + 1;
+            if (end - begin > BUILD_TASK_THRESHOLD) {
+#pragma omp task default(none) firstprivate(left, begin, mid, depth)
+                buildRecursive(left, begin, mid, depth + 1);
+                buildRecursive(left + 1, mid, end, depth + 1);
+#pragma omp taskwait
+            } else {
+                buildRecursive(left, begin, mid, depth + 1);
+                buildRecursive(left + 1, mid, end, depth + 1);
+            }
+            node.flat_size = 1 + nodes[left].flat_size + nodes[left + 1].flat_size;
+        }
+
+        static int binIndex(float centroid, float low, float extent) {
+            int b = (int) ((float) SAH_BIN_COUNT * (centroid - low) / extent);
+            return std::min(std::max(b, 0), SAH_BIN_COUNT - 1);
+        }
+
+        const std::vector<AABB> &prim_bounds;
+        std::vector<int> &prim_order;
+        std::vector<Vec3f> centroids;
+        std::vector<BuildNode> nodes;
+        std::atomic<int> node_count{0};
+    };
+
+    /// Karras' parallel hierarchy emission over sorted Morton codes.
+    /// internal node i is nodes[i] (0 <= i < n - 1), leaf k is nodes[n - 1 + k].
+    class KarrasBuilder {
+    public:
+        KarrasBuilder(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order)
+                : prim_bounds(prim_bounds), prim_order(prim_order), n((int) prim_bounds.size()) {}
+
+        std::vector<LBVHNode> build() {
+            computeMortonCodes();
+            radixSortPairs(codes, prim_order);
+            nodes.resize(2 * n - 1);
+            parents.resize(2 * n - 1);
+            parents[0] = -1;
+#pragma omp parallel for default(none)
+            for (int i = 0; i < n - 1; ++i) emitInternalNode(i);
+            computeBounds();
+            return flattenBuildTree(nodes, 0);
+        }
+
+    private:
+        void computeMortonCodes() {
+            AABB centroid_bounds = EMPTY_AABB;
+#pragma omp parallel shared(centroid_bounds)
+            {
+                AABB local = EMPTY_AABB;
+#pragma omp for nowait
+                for (int i = 0; i < n; ++i) {
+                    Vec3f c = prim_bounds[i].getCenter();
+                    local = AABB(local, AABB(c, c));
+                }
+#pragma omp critical
+                centroid_bounds = AABB(centroid_bounds, local);
+            }
+            Vec3f extent = (centroid_bounds.upper_bnd - centroid_bounds.low_bnd).cwiseMax(EPS);
+            codes.resize(n);
+#pragma omp parallel for default(none) shared(centroid_bounds, extent)
+            for (int i = 0; i < n; ++i) {
+                Vec3f v = (prim_bounds[i].getCenter() - centroid_bounds.low_bnd).array() / extent.array();
+                codes[i] = utils::morton3D(v);
+            }
+        }
+
+        /// length of the common prefix of keys i and j, ties broken by index
+        [[nodiscard]] int delta(int i, int j) const {
+            if (j < 0 || j >= n) return -1;
+            if (codes[i] == codes[j]) return 32 + __builtin_clz((unsigned int) (i ^ j));
+            return __builtin_clz(codes[i] ^ codes[j]);
+        }
+
+        void emitInternalNode(int i) {
+            // direction of the range and its other end
+            int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+            int delta_min = delta(i, i - d);
+            int l_max = 2;
+            while (delta(i, i + l_max * d) > delta_min) l_max *= 2;
+            int l = 0;
+            for (int t = l_max / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (l + t) * d) > delta_min) l += t;
+            }
+            int j = i + l * d;
+            // binary search for the split position
+            int delta_node = delta(i, j);
+            int s = 0;
+            for (int t = (l + 1) / 2;; t = (t + 1) / 2) {
+                if (delta(i, i + (s + t) * d) > delta_node) s += t;
+                if (t == 1) break;
+            }
+            int gamma = i + s * d + std::min(d, 0);
+            int first = std::min(i, j), last = std::max(i, j);
+            BuildNode &node = nodes[i];
+            node.left = first == gamma ? n - 1 + gamma : gamma;
+            node.right = last == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+            node.begin = first;
+            node.end = last + 1;
+            parents[node.left] = i;
+            parents[node.right] = i;
+        }
+
+        /// bottom-up pass: the second thread to reach a node merges its children
+        void computeBounds() {
+            std::vector<std::atomic<int>> visits(n - 1);
+            for (auto &v: visits) v.store(0, std::memory_order_relaxed);
+#pragma omp parallel for default(none) shared(visits)
+            for (int k = 0; k < n; ++k) {
+                BuildNode &leaf = nodes[n - 1 + k];
+                leaf.aabb = prim_bounds[prim_order[k]];
+                leaf.begin = k;
+                leaf.end = k + 1;
+                int idx = parents[n - 1 + k];
+                while (idx != -1 && visits[idx].fetch_add(1, std::memory_order_acq_rel) == 1) {
+                    BuildNode &node = nodes[idx];
+                    node.aabb = AABB(nodes[node.left].aabb, nodes[node.right].aabb);
+                    if (node.end - node.begin <= BVH_MAX_LEAF_SIZE) {
+                        // collapse small subtrees into a single leaf
+                        node.left = -1;
+                        node.flat_size = 1;
+                    } else {
+                        node.flat_size = 1 + nodes[node.left].flat_size + nodes[node.right].flat_size;
+                    }
+                    idx = parents[idx];
+                }
+            }
+        }
+
+        const std::vector<AABB> &prim_bounds;
+        std::vector<int> &prim_order;
+        int n;
+        std::vector<unsigned int> codes;
+        std::vector<BuildNode> nodes;
+        std::vector<int> parents;
+    };
+
+    /// Treelet restructuring after Karras and Aila, "Fast Parallel Construction of High-Quality BVHs".
+    /// The flat tree is unpacked into BuildNodes with parent links, every pass walks it bottom-up in
+    /// parallel and replaces each treelet by its SAH-optimal topology found by dynamic programming.
+    class TreeletOptimizer {
+    public:
+        explicit TreeletOptimizer(const std::vector<LBVHNode> &flat)
+                : n((int) flat.size()), nodes(flat.size()), parents(flat.size(), -1),
+                  costs(flat.size()), leaf_counts(flat.size()) {
+#pragma omp parallel for default(none) shared(flat)
+            for (int i = 0; i < n; ++i) {
+                BuildNode &node = nodes[i];
+                node.aabb = flat[i].aabb;
+                if (flat[i].triangle_begin_idx != -1) {
+                    node.begin = flat[i].triangle_begin_idx;
+                    node.end = flat[i].triangle_end_idx + 1;
+                } else {
+                    // both builders emit internal nodes with two children
+                    node.left = i + 1;
+                    node.right = flat[i].right_idx;
+                    parents[node.left] = i;
+                    parents[node.right] = i;
+                }
+            }
+            for (int i = 0; i < n; ++i) {
+                if (nodes[i].left == -1) leaves.push_back(i);
+            }
+        }
+
+        std::vector<LBVHNode> optimize(int iterations) {
+            for (int iter = 0; iter < iterations; ++iter) {
+                // later passes only revisit the larger subtrees, as in the paper
+                runPass(TREELET_SIZE << iter);
+            }
+            return flattenBuildTree(nodes, 0);
+        }
+
+    private:
+        void runPass(int min_leaf_count) {
+            std::vector<std::atomic<int>> visits(n);
+            for (auto &v: visits) v.store(0, std::memory_order_relaxed);
+#pragma omp parallel for schedule(dynamic, 256) default(none) shared(visits, min_leaf_count)
+            for (int k = 0; k < (int) leaves.size(); ++k) {
+                int idx = leaves[k];
+                BuildNode &leaf = nodes[idx];
+                costs[idx] = SAH_INTERSECTION_COST * (float) (leaf.end - leaf.begin) * leaf.aabb.getSurfaceArea();
+                leaf_counts[idx] = 1;
+                leaf.flat_size = 1;
+                idx = parents[idx];
+                while (idx != -1 && visits[idx].fetch_add(1, std::memory_order_acq_rel) == 1) {
+                    updateNode(idx);
+                    if (leaf_counts[idx] >= min_leaf_count) restructure(idx);
+                    idx = parents[idx];
+                }
+            }
+        }
+
+        void updateNode(int idx) {
+            BuildNode &node = nodes[idx];
+            node.aabb = AABB(nodes[node.left].aabb, nodes[node.right].aabb);
+            node.flat_size = 1 + nodes[node.left].flat_size + nodes[node.right].flat_size;
+            costs[idx] = SAH_TRAVERSAL_COST * node.aabb.getSurfaceArea() + costs[node.left] + costs[node.right];
+            leaf_counts[idx] = leaf_counts[node.left] + leaf_counts[node.right];
+        }
+
+        void restructure(int root) {
+            // grow the treelet by repeatedly expanding the treelet leaf with the largest area
+            int treelet_leaves[TREELET_SIZE], internals[TREELET_SIZE - 1];
+            int leaf_num = 2, internal_num = 1;
+            treelet_leaves[0] = nodes[root].left;
+            treelet_leaves[1] = nodes[root].right;
+            internals[0] = root;
+            while (leaf_num < TREELET_SIZE) {
+                int best = -1;
+                float best_area = -1;
+                for (int i = 0; i < leaf_num; ++i) {
+                    const BuildNode &candidate = nodes[treelet_leaves[i]];
+                    if (candidate.left != -1 && candidate.aabb.getSurfaceArea() > best_area) {
+                        best = i;
+                        best_area = candidate.aabb.getSurfaceArea();
+                    }
+                }
+                if (best == -1) break;
+                int expanded = treelet_leaves[best];
+                internals[internal_num++] = expanded;
+                treelet_leaves[best] = nodes[expanded].left;
+                treelet_leaves[leaf_num++] = nodes[expanded].right;
+            }
+            if (leaf_num < 3) return;
+
+            // optimal cost of every subset of treelet leaves, smaller subsets first
+            int subset_num = 1 << leaf_num;
+            AABB subset_bounds[1 << TREELET_SIZE];
+            float subset_cost[1 << TREELET_SIZE];
+            int subset_split[1 << TREELET_SIZE];
+            for (int s = 1; s < subset_num; ++s) {
+                int low = __builtin_ctz(s);
+                int rest = s & (s - 1);
+                const BuildNode &leaf = nodes[treelet_leaves[low]];
+                if (rest == 0) {
+                    subset_bounds[s] = leaf.aabb;
+                    subset_cost[s] = costs[treelet_leaves[low]];
+                    continue;
+                }
+                subset_bounds[s] = AABB(subset_bounds[rest], leaf.aabb);
+                // partitions are symmetric, so only those holding the lowest leaf are enumerated
+                int low_bit = s & -s;
+                float best = std::numeric_limits<float>::max();
+                for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+                    if (!(p & low_bit)) continue;
+                    float cost = subset_cost[p] + subset_cost[s ^ p];
+                    if (cost < best) {
+                        best = cost;
+                        subset_split[s] = p;
+                    }
+                }
+                subset_cost[s] = SAH_TRAVERSAL_COST * subset_bounds[s].getSurfaceArea() + best;
+            }
+            if (subset_cost[subset_num - 1] >= costs[root] * (1 - 1e-5f)) return;
+
+            int next_internal = 0;
+            rebuild(subset_num - 1, treelet_leaves, internals, next_internal, subset_split);
+        }
+
+        int rebuild(int subset, const int *treelet_leaves, const int *internals, int &next_internal,
+                    const int *subset_split) {
+            if ((subset & (subset - 1)) == 0) return treelet_leaves[__builtin_ctz(subset)];
+            int idx = internals[next_internal++];
+            int left = rebuild(subset_split[subset], treelet_leaves, internals, next_internal, subset_split);
+            int right = rebuild(subset ^ subset_split[subset], treelet_leaves, internals, next_internal, subset_split);
+            nodes[idx].left = left;
+            nodes[idx].right = right;
+            parents[left] = idx;
+            parents[right] = idx;
+            updateNode(idx);
+            return idx;
+        }
+
+        int n;
+        std::vector<BuildNode> nodes;
+        std::vector<int> parents;
+        std::vector<float> costs;
+        std::vector<int> leaf_counts;
+        std::vector<int> leaves;
+    };
+}
+
+std::vector<LBVHNode> buildLBVH(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order) {
+    prim_order.resize(prim_bounds.size());
+    std::iota(prim_order.begin(), prim_order.end(), 0);
+    if (prim_bounds.empty()) return {};
+    if (prim_bounds.size() == 1) {
+        std::vector<LBVHNode> flat(1, LBVHNode(prim_bounds[0]));
+        flat[0].triangle_begin_idx = 0;
+        flat[0].triangle_end_idx = 0;
+        return flat;
+    }
+    KarrasBuilder builder(prim_bounds, prim_order);
+    std::vector<LBVHNode> nodes = builder.build();
+    // duplicate Morton codes are split by index, which can nest too deep for the traversal stack
+    if (computeBVHDepth(nodes) > BVH_MAX_DEPTH) return buildBinnedSAHBVH(prim_bounds, prim_order);
+    return nodes;
+}
+
+std::vector<LBVHNode> buildBinnedSAHBVH(const std::vector<AABB> &prim_bounds, std::vector<int> &prim_order) {
+    prim_order.resize(prim_bounds.size());
+    std::iota(prim_order.begin(), prim_order.end(), 0);
+    if (prim_bounds.empty()) return {};
+    BinnedSAHBuilder builder(prim_bounds, prim_order);
+    return builder.build();
+}
+
+float computeSAHCost(const std::vector<LBVHNode> &nodes) {
+    if (nodes.empty()) return 0;
+    float cost = 0;
+    for (const auto &node: nodes) {
+        if (node.triangle_begin_idx != -1) {
+            int count = node.triangle_end_idx - node.triangle_begin_idx + 1;
+            cost += SAH_INTERSECTION_COST * (float) count * node.aabb.getSurfaceArea();
+        } else {
+            cost += SAH_TRAVERSAL_COST * node.aabb.getSurfaceArea();
+        }
+    }
+    return cost / nodes[0].aabb.getSurfaceArea();
+}
+
+std::vector<LBVHNode> optimizeBVHTreelets(const std::vector<LBVHNode> &nodes, int iterations) {
+    if (nodes.size() < 3 || iterations <= 0) return nodes;
+    TreeletOptimizer optimizer(nodes);
+    std::vector<LBVHNode> optimized = optimizer.optimize(iterations);
+    return computeBVHDepth(optimized) > BVH_MAX_DEPTH ? nodes : optimized;
+}
+
+bool isValidBVH(const std::vector<LBVHNode> &nodes, int prim_count) {
+    if (nodes.empty()) return prim_count == 0;
+    int node_count = (int) nodes.size();
+    for (int i = 0; i < node_count; ++i) {
+        const LBVHNode &node = nodes[i];
+        if (node.triangle_begin_idx != -1) {
+            if (node.triangle_begin_idx < 0 || node.triangle_begin_idx > node.triangle_end_idx
+                || node.triangle_end_idx >= prim_count) {
+                return false;
+            }
+        } else if (i + 1 >= node_count || node.right_idx <= i + 1 || node.right_idx >= node_count) {
+            return false;
+        }
+    }
+    return computeBVHDepth(nodes) <= BVH_MAX_DEPTH;
+}
+
+int computeBVHDepth(const std::vector<LBVHNode> &nodes) {
+    // parents precede their children in the flattened layout
+    std::vector<int> depths(nodes.size(), 0);
+    int max_depth = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        max_depth = std::max(max_depth, depths[i]);
+        if (nodes[i].triangle_begin_idx != -1) continue;
+        depths[i + 1] = depths[i] + 1;
+        depths[nodes[i].right_idx] = depths[i] + 1;
+    }
+    return max_depth;
+}
+
+void radixSortPairs(std::vector<unsigned int> &keys, std::vector<int> &values, int key_bits) {
+    size_t n = keys.size();
+    std::vector<unsigned int> keys_tmp(n);
+    std::vector<int> values_tmp(n);
+    std::vector<size_t> histogram((size_t) omp_get_max_threads() * RADIX_BUCKETS);
+    for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+#pragma omp parallel default(none) shared(n, keys, values, keys_tmp, values_tmp, histogram, shift)
+        {
+            int tid = omp_get_thread_num(), num_threads = omp_get_num_threads();
+            size_t begin = n * tid / num_threads, end = n * (tid + 1) / num_threads;
+            size_t *local = &histogram[(size_t) tid * RADIX_BUCKETS];
+            std::fill(local, local + RADIX_BUCKETS, 0);
+            for (size_t i = begin; i < end; ++i) ++local[(keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+#pragma omp barrier
+#pragma omp single
+            {
+                // bucket-major exclusive scan keeps the sort stable across threads
+                size_t sum = 0;
+                for (int b = 0; b < RADIX_BUCKETS; ++b) {
+                    for (int t = 0; t < num_threads; ++t) {
+                        size_t cnt = histogram[(size_t) t * RADIX_BUCKETS + b];
+                        histogram[(size_t) t * RADIX_BUCKETS + b] = sum;
+                        sum += cnt;
+                    }
+                }
+            }
+            for (size_t i = begin; i < end; ++i) {
+                size_t dst = local[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        }
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
@@ -0,0 +1,48 @@
+#include "binary_io.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return;
+    buffer.resize((size_t) file.tellg());
+    file.seekg(0);
+    if (!file.read(buffer.data(), (std::streamsize) buffer.size())) return;
+    data = buffer.data();
+    size = buffer.size();
+    opened = true;
+}
+
+MappedFile::~MappedFile() = default;
+#else
+MappedFile::MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat status{};
+    if (fstat(fd, &status) == 0) {
+        size = (size_t) status.st_size;
+        // an empty file cannot be mapped, it is opened with no data
+        if (size == 0) {
+            opened = true;
+        } else {
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<const char *>(mapping);
+                opened = true;
+            }
+        }
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) munmap(const_cast<char *>(data), size);
+}
+#endif
@@ -1,8 +1,23 @@
 #include "bsdf.h"
 #include "utils.h"
+#include "sampler.h"
 
 #include <utility>
 
+namespace {
+    /// direction (x, y, z) given in the frame with z along the unit vector n, in world space
+    Vec3f toWorld(const Vec3f &n, float x, float y, float z) {
+        Vec3f t, b;
+        utils::coordinateSystem(n, t, b);
+        return x * t + y * b + z * n;
+    }
+
+    /// mirror the incoming direction wo about the normal
+    Vec3f reflect(const Vec3f &wo, const Vec3f &normal) {
+        return wo - 2 * wo.dot(normal) * normal;
+    }
+}
+
 IdealDiffusion::IdealDiffusion(Vec3f color) : color(std::move(color)) {}
 
 Vec3f IdealDiffusion::evaluate(Interaction &interaction) const {
@@ -10,30 +25,18 @@ Vec3f IdealDiffusion::evaluate(Interaction &interaction) const {
 }
 
 float IdealDiffusion::pdf(Interaction &interaction) const {
-    Vec3f dir = interaction.wi;
-    float theta = std::acos(dir.z());
-    return std::cos(theta) / PI;
+    float cosine = interaction.wi.dot(interaction.normal);
+    return std::max(cosine, 0.0f) * INV_PI;
 }
 
 float IdealDiffusion::sample(Interaction &interaction, Sampler &sampler) const {
+    // cosine weighted, sin(theta) = sqrt(xi_1)
     Vec2f samples = sampler.get2D();
-    float xi_1 = samples.x();
-    float xi_2 = samples.y();
-    float theta = std::acos(std::sqrt(1 - xi_1));
-    float phi = 2 * PI * xi_2;
-    float x = std::sin(theta) * std::cos(phi);
-    float y = std::sin(theta) * std::sin(phi);
-    float z = std::cos(theta);
-    interaction.wi = Vec3f(x, y, z);
-    float PDF = pdf(interaction);
-    Mat3f R = Eigen::Quaternion<float>::FromTwoVectors(Vec3f(0, 0, 1), interaction.normal).toRotationMatrix();
-    interaction.wi = (R * interaction.wi).normalized();
-    return PDF;
-}
-
-/// return whether the bsdf is perfect transparent or perfect reflection
-bool IdealDiffusion::isDelta() const {
-    return false;
+    float r = std::sqrt(samples.x());
+    float phi = 2 * PI * samples.y();
+    interaction.wi = toWorld(interaction.normal, r * std::cos(phi), r * std::sin(phi),
+                             std::sqrt(std::max(1 - samples.x(), 0.0f)));
+    return pdf(interaction);
 }
 
 Vec3f IdealSpecular::evaluate(Interaction &interaction) const {
@@ -41,15 +44,93 @@ Vec3f IdealSpecular::evaluate(Interaction &interaction) const {
     return Vec3f{1, 1, 1} / cosine;
 }
 
-bool IdealSpecular::isDelta() const {
-    return true;
-}
-
 float IdealSpecular::sample(Interaction &interaction, Sampler &sampler) const {
-    interaction.wi = (interaction.wo + 2 * (-interaction.wo).dot(interaction.normal) * interaction.normal).normalized();
+    interaction.wi = reflect(interaction.wo, interaction.normal).normalized();
     return 1.0f;
 }
 
 float IdealSpecular::pdf(Interaction &interaction) const {
     return 1.0f;
 }
+
+Glossy::Glossy(Vec3f color, float exponent) : color(std::move(color)), exponent(exponent) {}
+
+Vec3f Glossy::evaluate(Interaction &interaction) const {
+    if (interaction.wi.dot(interaction.normal) <= 0) return {0, 0, 0};
+    float cos_alpha = std::max(interaction.wi.dot(reflect(interaction.wo, interaction.normal)), 0.0f);
+    return color * (exponent + 2) * 0.5f * INV_PI * std::pow(cos_alpha, exponent);
+}
+
+float Glossy::pdf(Interaction &interaction) const {
+    float cos_alpha = std::max(interaction.wi.dot(reflect(interaction.wo, interaction.normal)), 0.0f);
+    return (exponent + 1) * 0.5f * INV_PI * std::pow(cos_alpha, exponent);
+}
+
+float Glossy::sample(Interaction &interaction, Sampler &sampler) const {
+    Vec2f samples = sampler.get2D();
+    float cos_alpha = std::pow(samples.x(), 1 / (exponent + 1));
+    float sin_alpha = std::sqrt(std::max(1 - cos_alpha * cos_alpha, 0.0f));
+    float phi = 2 * PI * samples.y();
+    interaction.wi = toWorld(reflect(interaction.wo, interaction.normal), sin_alpha * std::cos(phi),
+                             sin_alpha * std::sin(phi), cos_alpha);
+    if (interaction.wi.dot(interaction.normal) <= 0) return 0;
+    return pdf(interaction);
+}
+
+Dielectric::Dielectric(Vec3f color, float ior) : color(std::move(color)), ior(ior) {}
+
+Vec3f Dielectric::evaluate(Interaction &interaction) const {
+    // cancels the cosine of the integrator like IdealSpecular, the Fresnel terms cancel with the
+    // probabilities of choosing reflection or refraction. Only refraction, which keeps wi on the far
+    // side of the surface like wo, passes through the tinted material.
+    float cos_wi = interaction.wi.dot(interaction.normal);
+    bool refracted = cos_wi * interaction.wo.dot(interaction.normal) > 0;
+    return (refracted ? color : Vec3f(1, 1, 1)) / cos_wi;
+}
+
+float Dielectric::pdf(Interaction &interaction) const {
+    return 1.0f;
+}
+
+float Dielectric::sample(Interaction &interaction, Sampler &sampler) const {
+    float cos_i = -interaction.wo.dot(interaction.normal);
+    Vec3f normal = interaction.normal;
+    // relative index of refraction, the ray leaves the object when it hits the back of the surface
+    float eta = 1 / ior;
+    if (cos_i < 0) {
+        cos_i = -cos_i;
+        normal = -normal;
+        eta = ior;
+    }
+    float sin2_t = eta * eta * std::max(1 - cos_i * cos_i, 0.0f);
+    float fresnel = 1;
+    float cos_t = 0;
+    if (sin2_t < 1) {
+        cos_t = std::sqrt(1 - sin2_t);
+        float r_parallel = (cos_i - eta * cos_t) / (cos_i + eta * cos_t);
+        float r_perpendicular = (eta * cos_i - cos_t) / (eta * cos_i + cos_t);
+        fresnel = (r_parallel * r_parallel + r_perpendicular * r_perpendicular) / 2;
+    }
+    if (sampler.get1D() < fresnel) {
+        interaction.wi = reflect(interaction.wo, normal).normalized();
+    } else {
+        interaction.wi = (eta * interaction.wo + (eta * cos_i - cos_t) * normal).normalized();
+    }
+    return 1.0f;
+}
+
+Vec3f BSDF::evaluate(Interaction &interaction) const {
+    return std::visit([&](const auto &bsdf) { return bsdf.evaluate(interaction); }, this->bsdf);
+}
+
+float BSDF::pdf(Interaction &interaction) const {
+    return std::visit([&](const auto &bsdf) { return bsdf.pdf(interaction); }, this->bsdf);
+}
+
+float BSDF::sample(Interaction &interaction, Sampler &sampler) const {
+    return std::visit([&](const auto &bsdf) { return bsdf.sample(interaction, sampler); }, this->bsdf);
+}
+
+bool BSDF::isDelta() const {
+    return std::visit([](const auto &bsdf) { return bsdf.isDelta(); }, bsdf);
+}
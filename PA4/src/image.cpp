@@ -4,6 +4,8 @@
 
 #include "image.h"
 
+#include <algorithm>
+
 ImageRGB::ImageRGB(int width, int height)
         : resolution(width, height) {
     data.resize(width * height);
@@ -21,6 +23,12 @@ void ImageRGB::setPixel(int x, int y, const Vec3f &value) {
     data[x + resolution.x() * y] = value;
 }
 
+void ImageRGB::setBlock(int x0, int y0, int width, int height, const Vec3f *values) {
+    for (int y = 0; y < height; ++y) {
+        std::copy(values + y * width, values + (y + 1) * width, data.begin() + x0 + resolution.x() * (y0 + y));
+    }
+}
+
 void ImageRGB::writeImgToFile(const std::string &file_name) {
     std::vector<uint8_t> rgb_data(resolution.x() * resolution.y() * 3);
     for (int i = 0; i < data.size(); i++) {
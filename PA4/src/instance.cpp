@@ -0,0 +1,155 @@
+#include "instance.h"
+#include "utils.h"
+#include "binary_io.h"
+
+void BLAS::build(const std::vector<Triangle> &new_triangles, const Config::AccelConfig &accel_config,
+                 std::vector<int> &prim_order) {
+    int triangle_count = (int) new_triangles.size();
+    std::vector<AABB> prim_bounds(triangle_count);
+#pragma omp parallel for default(none) shared(triangle_count, prim_bounds, new_triangles)
+    for (int i = 0; i < triangle_count; ++i) prim_bounds[i] = new_triangles[i].getAABB();
+    LBVH = accel_config.builder == BVHBuilderType::BINNED_SAH
+           ? buildBinnedSAHBVH(prim_bounds, prim_order)
+           : buildLBVH(prim_bounds, prim_order);
+    if (accel_config.optimize_iterations > 0) LBVH = optimizeBVHTreelets(LBVH, accel_config.optimize_iterations);
+    // reorder the triangles so that leaf ranges are contiguous
+    std::vector<Triangle> sorted_triangles(triangle_count);
+#pragma omp parallel for default(none) shared(triangle_count, sorted_triangles, new_triangles, prim_order)
+    for (int i = 0; i < triangle_count; ++i) sorted_triangles[i] = new_triangles[prim_order[i]];
+    triangles = TriangleStore();
+    triangles.build(sorted_triangles);
+
+    bvh_width = accel_config.width;
+    bvh_compressed = accel_config.compressed && bvh_width != 2;
+    wide_bvh4 = WideBVH<4>();
+    wide_bvh8 = WideBVH<8>();
+    quantized_bvh4 = QuantizedWideBVH<4>();
+    quantized_bvh8 = QuantizedWideBVH<8>();
+    if (bvh_width == 4) bvh_compressed ? quantized_bvh4.build(LBVH) : wide_bvh4.build(LBVH);
+    else if (bvh_width == 8) bvh_compressed ? quantized_bvh8.build(LBVH) : wide_bvh8.build(LBVH);
+}
+
+bool BLAS::intersect(const TraversalRay &ray, HitRecord &hit) const {
+    auto leaf_test = [this, &ray](int begin, int end, HitRecord &leaf_hit) {
+        return triangles.intersectLeaf(ray, begin, end, leaf_hit);
+    };
+    switch (bvh_width) {
+        case 4:
+            if (bvh_compressed) return quantized_bvh4.intersect(ray, hit, leaf_test);
+            return wide_bvh4.intersect(ray, hit, leaf_test);
+        case 8:
+            if (bvh_compressed) return quantized_bvh8.intersect(ray, hit, leaf_test);
+            return wide_bvh8.intersect(ray, hit, leaf_test);
+        default:
+            return intersectBVH(LBVH, ray, hit, leaf_test);
+    }
+}
+
+bool BLAS::occluded(const TraversalRay &ray) const {
+    auto leaf_test = [this, &ray](int begin, int end) {
+        return triangles.occludedLeaf(ray, begin, end);
+    };
+    switch (bvh_width) {
+        case 4:
+            if (bvh_compressed) return quantized_bvh4.occluded(ray, leaf_test);
+            return wide_bvh4.occluded(ray, leaf_test);
+        case 8:
+            if (bvh_compressed) return quantized_bvh8.occluded(ray, leaf_test);
+            return wide_bvh8.occluded(ray, leaf_test);
+        default:
+            return occludedBVH(LBVH, ray, leaf_test);
+    }
+}
+
+void BLAS::intersectPacket(RayPacket &packet, uint64_t active) const {
+    // packets always traverse the binary BVH
+    intersectPacketBVH(LBVH, packet, [this, &packet, active](int begin, int end, uint64_t leaf_active) {
+        triangles.intersectPacket(packet, begin, end, leaf_active & active);
+    });
+}
+
+size_t BLAS::getBVHMemorySize() const {
+    switch (bvh_width) {
+        case 4:
+            return bvh_compressed ? quantized_bvh4.getMemorySize() : wide_bvh4.getMemorySize();
+        case 8:
+            return bvh_compressed ? quantized_bvh8.getMemorySize() : wide_bvh8.getMemorySize();
+        default:
+            return LBVH.size() * sizeof(LBVHNode);
+    }
+}
+
+void BLAS::write(BinaryWriter &writer) const {
+    triangles.write(writer);
+    writer.writeArray(LBVH);
+    writer.write<int32_t>(bvh_width);
+    writer.write<int32_t>(bvh_compressed);
+    if (bvh_width == 4) bvh_compressed ? writer.writeArray(quantized_bvh4.getNodes())
+                                       : writer.writeArray(wide_bvh4.getNodes());
+    else if (bvh_width == 8) bvh_compressed ? writer.writeArray(quantized_bvh8.getNodes())
+                                            : writer.writeArray(wide_bvh8.getNodes());
+}
+
+bool BLAS::read(BinaryReader &reader, int material_count) {
+    int32_t width, compressed;
+    if (!triangles.read(reader, material_count) || !reader.readArray(LBVH) || !reader.read(width) || !reader.read(compressed)) {
+        return false;
+    }
+    // packets traverse the binary BVH whatever the width
+    int triangle_count = (int) triangles.size();
+    if (!isValidBVH(LBVH, triangle_count)) return false;
+    bvh_width = width;
+    bvh_compressed = compressed != 0;
+    if (bvh_width == 2) return !bvh_compressed;
+    if (bvh_width != 4 && bvh_width != 8) return false;
+    // the nodes are read into a vector of the layout in use and moved into it
+    auto read_nodes = [&reader, triangle_count](auto &bvh) {
+        std::remove_const_t<std::remove_reference_t<decltype(bvh.getNodes())>> nodes;
+        if (!reader.readArray(nodes)) return false;
+        bvh.setNodes(std::move(nodes));
+        return bvh.isValid(triangle_count);
+    };
+    if (bvh_width == 4) return bvh_compressed ? read_nodes(quantized_bvh4) : read_nodes(wide_bvh4);
+    return bvh_compressed ? read_nodes(quantized_bvh8) : read_nodes(wide_bvh8);
+}
+
+Instance::Instance(int blas_id, int material_id, const Mat3f &linear, const Vec3f &translation,
+                   const AABB &object_bounds)
+        : blas_id(blas_id), material_id(material_id), linear(linear), translation(translation),
+          inv_linear(linear.inverse()), inv_translation(-(linear.inverse() * translation)),
+          identity(linear == Mat3f::Identity() && translation == Vec3f::Zero()) {
+    // bounds of the transformed corners of the object bounds
+    Vec3f corner = linear * object_bounds.low_bnd + translation;
+    bounds = AABB(corner, corner);
+    for (int i = 1; i < 8; ++i) {
+        Vec3f p((i & 1 ? object_bounds.upper_bnd : object_bounds.low_bnd).x(),
+                (i & 2 ? object_bounds.upper_bnd : object_bounds.low_bnd).y(),
+                (i & 4 ? object_bounds.upper_bnd : object_bounds.low_bnd).z());
+        corner = linear * p + translation;
+        bounds = AABB(bounds, AABB(corner, corner));
+    }
+}
+
+Triangle Instance::toWorld(const Triangle &triangle) const {
+    return transformTriangle(triangle, linear, translation,
+                             material_id == -1 ? triangle.getMaterialId() : material_id);
+}
+
+Triangle transformTriangle(const Triangle &triangle, const Mat3f &linear, const Vec3f &translation, int material_id) {
+    // normals go with the inverse transpose, which is a multiple of linear for uniform scales
+    Mat3f normal_matrix = linear.inverse().transpose();
+    Vec3f v[3], n[3];
+    for (int k = 0; k < 3; ++k) {
+        v[k] = linear * triangle.getVertex(k) + translation;
+        n[k] = normal_matrix * triangle.getNormal(k);
+    }
+    return {v[0], v[1], v[2], n[0], n[1], n[2], material_id};
+}
+
+void transformFromConfig(const Config::TransformConfig &transform, Mat3f &linear, Vec3f &translation) {
+    Mat3f rotation = (Eigen::AngleAxisf(utils::radians(transform.rotate[2]), Vec3f::UnitZ())
+                      * Eigen::AngleAxisf(utils::radians(transform.rotate[1]), Vec3f::UnitY())
+                      * Eigen::AngleAxisf(utils::radians(transform.rotate[0]), Vec3f::UnitX())).toRotationMatrix();
+    linear = rotation * Vec3f(transform.scale).asDiagonal();
+    translation = Vec3f(transform.translate);
+}
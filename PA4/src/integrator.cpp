@@ -2,65 +2,276 @@
 #include "utils.h"
 #include <omp.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
 #include <utility>
 #include <iostream>
+#include <limits>
+
+namespace {
+    // passes a render is split into when a time budget or previews need passes but pass_spp is unset
+    constexpr int DEFAULT_PASS_COUNT = 16;
+
+    /// top left pixels of the tiles covering the image, in the order they are rendered
+    std::vector<Vec2i> orderTiles(const Vec2i &resolution, int tile_size, TileOrder order) {
+        int tiles_x = (resolution.x() + tile_size - 1) / tile_size;
+        int tiles_y = (resolution.y() + tile_size - 1) / tile_size;
+        // side of the smallest power-of-two grid holding all tiles, for the Hilbert curve
+        unsigned int grid = 1;
+        while (grid < (unsigned int) std::max(tiles_x, tiles_y)) grid *= 2;
+        std::vector<std::pair<unsigned int, Vec2i>> keyed;
+        keyed.reserve(tiles_x * tiles_y);
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                unsigned int key = ty * tiles_x + tx;
+                if (order == TileOrder::MORTON) key = utils::morton2D(tx, ty);
+                else if (order == TileOrder::HILBERT) key = utils::hilbert2D(grid, tx, ty);
+                keyed.emplace_back(key, Vec2i(tx * tile_size, ty * tile_size));
+            }
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        std::vector<Vec2i> tiles;
+        tiles.reserve(keyed.size());
+        for (const auto &tile: keyed) tiles.push_back(tile.second);
+        return tiles;
+    }
+}
 
 Integrator::Integrator(std::shared_ptr<Camera> cam,
-                       std::shared_ptr<Scene> scene, int spp, int max_depth)
-        : camera(std::move(cam)), scene(std::move(scene)), spp(spp), max_depth(max_depth) {
+                       std::shared_ptr<Scene> scene, int spp, int max_depth,
+                       const Config::RenderConfig &render_config)
+        : camera(std::move(cam)), scene(std::move(scene)), spp(spp), max_depth(max_depth),
+          packet_tracing(render_config.packet_tracing),
+          tile_size((std::max(render_config.tile_size, 1) + PACKET_WIDTH - 1) / PACKET_WIDTH * PACKET_WIDTH),
+          tile_order(render_config.tile_order),
+          pass_spp(render_config.pass_spp), time_budget(render_config.time_budget),
+          preview_interval(render_config.preview_interval),
+          target_error(render_config.target_error), max_spp(render_config.max_spp),
+          russian_roulette_depth(render_config.russian_roulette_depth), sampler_type(render_config.sampler),
+          frame(render_config.frame) {
 }
 
 void Integrator::render() const {
     Vec2i resolution = camera->getImage()->getResolution();
-    int cnt = 0;
-    Sampler sampler;
-#pragma omp parallel for schedule(dynamic), default(none), shared(resolution, cnt), private(sampler)
-    for (int dx = 0; dx < resolution.x(); dx++) {
-#pragma omp atomic
-        ++cnt;
-        printf("\r%.02f%%", cnt * 100.0 / resolution.x());
-        std::random_device rd;
-        std::uniform_int_distribution<int> dist(0,10000);
-//        sampler.setSeed(omp_get_thread_num());
-        sampler.setSeed(dist(rd));
-        int num_sample = (int) std::sqrt(spp);
-        for (int dy = 0; dy < resolution.y(); dy++) {
-            Vec3f L(0, 0, 0);
-            // TODO: generate #spp rays for each pixel and use Monte Carlo integration to compute radiance.
-            for (int i = 0; i < num_sample; ++i) {
-                for (int j = 0; j < num_sample; ++j) {
-                    Ray ray = camera->generateRay((float) dx + (float) i / (float) num_sample,
-                                                  (float) dy + (float) j / (float) num_sample);
-                    L += radiance(ray, sampler);
+    int pixel_count = resolution.x() * resolution.y();
+    std::vector<Vec2i> tiles = orderTiles(resolution, tile_size, tile_order);
+    int tile_count = (int) tiles.size();
+    int num_sample = (int) std::sqrt(spp);
+    int samples_per_pixel = num_sample * num_sample;
+    bool adaptive = target_error > 0;
+    // every pixel gets samples_per_pixel samples, adaptive sampling keeps adding passes for the
+    // pixels whose error estimate is above the target
+    int max_samples = adaptive ? std::max(max_spp, samples_per_pixel) : samples_per_pixel;
+    int samples_per_pass = samples_per_pixel;
+    if (pass_spp > 0) samples_per_pass = std::min(pass_spp, samples_per_pixel);
+    else if (time_budget > 0 || preview_interval > 0) {
+        // both are only checked between passes, a single pass would ignore them
+        samples_per_pass = std::max(samples_per_pixel / DEFAULT_PASS_COUNT, 1);
+    }
+    int pass_count = (max_samples + samples_per_pass - 1) / samples_per_pass;
+    // radiance and squared luminance summed over all passes so far
+    std::vector<Vec3f> accumulation(pixel_count, Vec3f(0, 0, 0));
+    std::vector<float> luminance_sq(pixel_count, 0);
+    // samples taken per pixel, pixels stop receiving samples once they converged
+    std::vector<int> sample_counts(pixel_count, 0);
+    std::vector<char> active(pixel_count, 1);
+    long long total_samples = 0;
+    std::atomic<int> finished{0};
+    std::vector<std::unique_ptr<Sampler>> samplers(omp_get_max_threads());
+    // values only depend on pixel, sample and frame, the image does not depend on the thread count
+    for (auto &sampler: samplers) sampler = createSampler(sampler_type, frame);
+    auto start = std::chrono::steady_clock::now(), last_preview = start;
+    for (int pass = 0; pass < pass_count; ++pass) {
+        int first_sample = pass * samples_per_pass;
+        int pass_samples = std::min(samples_per_pass, max_samples - first_sample);
+        if (adaptive && first_sample >= samples_per_pixel) {
+            std::vector<char> noisy(pixel_count);
+#pragma omp parallel for default(none) shared(pixel_count, accumulation, luminance_sq, sample_counts, active, noisy)
+            for (int pixel = 0; pixel < pixel_count; ++pixel) {
+                noisy[pixel] = active[pixel] &&
+                               displayError(accumulation[pixel], luminance_sq[pixel], sample_counts[pixel]) > target_error;
+            }
+            // a pixel stops only once its whole 3x3 neighbourhood is below the target, single estimates
+            // of the variance are too noisy and stopping on an underestimate darkens the image
+            int active_count = 0;
+#pragma omp parallel for default(none) shared(resolution, active, noisy) reduction(+:active_count)
+            for (int y = 0; y < resolution.y(); ++y) {
+                for (int x = 0; x < resolution.x(); ++x) {
+                    if (!active[y * resolution.x() + x]) continue;
+                    bool any_noisy = false;
+                    for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, resolution.y() - 1); ++ny) {
+                        for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, resolution.x() - 1); ++nx) {
+                            any_noisy |= noisy[ny * resolution.x() + nx];
+                        }
+                    }
+                    active[y * resolution.x() + x] = any_noisy;
+                    active_count += any_noisy;
+                }
+            }
+            if (active_count == 0) break;
+        }
+        // sums of the current tile, merged into the accumulation buffers and the image once the
+        // tile is done so threads never write to shared cache lines while rendering
+        TileFilm film;
+#pragma omp parallel for schedule(dynamic), default(none), \
+        shared(resolution, tiles, tile_count, pass, pass_count, first_sample, pass_samples, accumulation, \
+               luminance_sq, sample_counts, active, finished, samplers), private(film) reduction(+:total_samples)
+        for (int tile = 0; tile < tile_count; tile++) {
+            Sampler &sampler = *samplers[omp_get_thread_num()];
+            int x0 = tiles[tile].x(), y0 = tiles[tile].y();
+            int width = std::min(tile_size, resolution.x() - x0), height = std::min(tile_size, resolution.y() - y0);
+            renderTile(tiles[tile], first_sample, pass_samples, active, sampler, film);
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    int pixel = (y0 + y) * resolution.x() + x0 + x, k = y * width + x;
+                    if (active[pixel]) {
+                        accumulation[pixel] += film.radiance[k];
+                        luminance_sq[pixel] += film.luminance_sq[k];
+                        sample_counts[pixel] += pass_samples;
+                        total_samples += pass_samples;
+                    }
+                    film.radiance[k] = accumulation[pixel] / (float) sample_counts[pixel];
+                }
+            }
+            camera->getImage()->setBlock(x0, y0, width, height, film.radiance.data());
+            int done = ++finished;
+            // a single thread reports, the others only bump the counter
+            if (omp_get_thread_num() == 0) printf("\r%.02f%%", done * 100.0 / (tile_count * pass_count));
+        }
+        if (pass + 1 == pass_count) break;
+        auto now = std::chrono::steady_clock::now();
+        if (time_budget > 0 && std::chrono::duration<float>(now - start).count() >= time_budget) {
+            printf("\nTime budget reached after %d spp.", first_sample + pass_samples);
+            break;
+        }
+        if (preview_interval > 0 && std::chrono::duration<float>(now - last_preview).count() >= preview_interval) {
+            camera->getImage()->writeImgToFile("../preview.png");
+            last_preview = now;
+        }
+    }
+    printf("\r%.02f%%", 100.0);
+    if (adaptive) {
+        printf("\nAdaptive sampling took %lld samples, %.2f spp on average.", total_samples,
+               (double) total_samples / pixel_count);
+    }
+}
+
+float Integrator::displayError(const Vec3f &radiance_sum, float luminance_sq_sum, int sample_count) {
+    if (sample_count < 2) return std::numeric_limits<float>::infinity();
+    float n = (float) sample_count;
+    float mean = utils::luminance(radiance_sum) / n;
+    float variance = std::max(luminance_sq_sum / n - mean * mean, 0.0f) * n / (n - 1);
+    // first order propagation through the gamma curve of the output, which flattens above 1 and
+    // is steepest for dark pixels, limited here by a floor
+    float slope = powf(std::min(std::max(mean, 0.01f), 1.0f), 1.f / 2.2f - 1.f) / 2.2f;
+    return std::sqrt(variance / n) * slope;
+}
+
+void Integrator::renderTile(const Vec2i &origin, int first_sample, int sample_count, const std::vector<char> &active,
+                            Sampler &sampler, TileFilm &film) const {
+    Vec2i resolution = camera->getImage()->getResolution();
+    int x0 = origin.x(), y0 = origin.y();
+    int width = std::min(tile_size, resolution.x() - x0), height = std::min(tile_size, resolution.y() - y0);
+    int num_sample = (int) std::sqrt(spp);
+    int samples_per_pixel = num_sample * num_sample;
+    // strata are visited with a stride coprime to their count, so the samples of any pass spread
+    // over the whole pixel
+    int stride = (int) (0.618f * (float) samples_per_pixel);
+    while (std::gcd(stride, samples_per_pixel) != 1) ++stride;
+    film.radiance.assign(width * height, Vec3f(0, 0, 0));
+    film.luminance_sq.assign(width * height, 0);
+    std::vector<Ray> rays;
+    rays.reserve(PACKET_SIZE);
+    // the tile is traced in packets of PACKET_WIDTH x PACKET_WIDTH pixels
+    for (int py = 0; py < height; py += PACKET_WIDTH) {
+        for (int px = 0; px < width; px += PACKET_WIDTH) {
+            // pixels past the image border repeat the last row / column so packets stay full
+            auto pixelOf = [&](int k) {
+                return Vec2i(std::min(x0 + px + k % PACKET_WIDTH, resolution.x() - 1),
+                             std::min(y0 + py + k / PACKET_WIDTH, resolution.y() - 1));
+            };
+            // pixels in the image that have not converged yet
+            auto sampled = [&](int k) {
+                return px + k % PACKET_WIDTH < width && py + k / PACKET_WIDTH < height
+                       && active[(y0 + py + k / PACKET_WIDTH) * resolution.x() + x0 + px + k % PACKET_WIDTH];
+            };
+            auto addSample = [&](int k, const Vec3f &L) {
+                int index = (py + k / PACKET_WIDTH) * width + px + k % PACKET_WIDTH;
+                film.radiance[index] += L;
+                film.luminance_sq[index] += utils::luminance(L) * utils::luminance(L);
+            };
+            bool any_sampled = false;
+            for (int k = 0; k < PACKET_SIZE && !any_sampled; ++k) any_sampled = sampled(k);
+            if (!any_sampled) continue;
+            for (int sample = first_sample; sample < first_sample + sample_count; ++sample) {
+                int stratum = (int) ((long long) sample * stride % samples_per_pixel);
+                int i = stratum / num_sample, j = stratum % num_sample;
+                rays.clear();
+                for (int k = 0; k < PACKET_SIZE; ++k) {
+                    Vec2i pixel = pixelOf(k);
+                    // the position in the pixel takes the first two sampler dimensions, independent
+                    // values are jittered within a stratum, low discrepancy points stratify by themselves
+                    sampler.startPixelSample(pixel, sample);
+                    Vec2f offset = sampler.get2D();
+                    if (sampler_type == SamplerType::INDEPENDENT) offset = (Vec2f((float) i, (float) j) + offset) / (float) num_sample;
+                    rays.push_back(camera->generateRay((float) pixel.x() + offset.x(), (float) pixel.y() + offset.y()));
+                }
+                int camera_dimensions = sampler.getDimension();
+                Interaction interactions[PACKET_SIZE];
+                if (packet_tracing) scene->intersectPacket(rays.data(), interactions);
+                for (int k = 0; k < PACKET_SIZE; ++k) {
+                    if (!sampled(k)) continue;
+                    sampler.startPixelSample(pixelOf(k), sample, camera_dimensions);
+                    addSample(k, packet_tracing ? radiance(rays[k], interactions[k], sampler) : radiance(rays[k], sampler));
                 }
             }
-            L = L / spp;
-            camera->getImage()->setPixel(dx, dy, L);
         }
     }
 }
 
 Vec3f Integrator::radiance(Ray &ray, Sampler &sampler) const {
+    Interaction interaction{};
+    scene->intersect(ray, interaction);
+    return radiance(ray, interaction, sampler);
+}
+
+Vec3f Integrator::radiance(Ray &ray, Interaction &interaction, Sampler &sampler) const {
     Vec3f L(0, 0, 0);
     Vec3f beta(1, 1, 1);
-    bool isDelta = false;
+    // pdf of the BSDF sample that produced ray, 0 for the camera ray and after delta bounces
+    float bsdf_pdf = 0;
+    // normal at the origin of ray, the light selection pdf depends on it
+    Vec3f normal(0, 0, 0);
     for (int i = 0; i < max_depth; ++i) {
         /// Compute radiance (direct + indirect)
-        Interaction interaction{};
-        if (!scene->intersect(ray, interaction)) break;
+        if (i > 0) {
+            interaction = Interaction{};
+            scene->intersect(ray, interaction);
+        }
+        if (interaction.type == Interaction::Type::NONE) {
+            L += beta.cwiseProduct(escapedRadiance(ray, bsdf_pdf, normal));
+            break;
+        }
         interaction.wo = ray.direction;
-        if (i == 0 && interaction.type == Interaction::Type::LIGHT) {
-            return scene->getLight()->emission(Vec3f(0, 0, 0), interaction.wo);
+        if (interaction.type == Interaction::Type::LIGHT) {
+            L += beta.cwiseProduct(emittedRadiance(ray, interaction.light_id, interaction.pos, bsdf_pdf, normal));
+            break;
         }
-        if (interaction.type == Interaction::Type::LIGHT) break;
 
         L += beta.cwiseProduct(directLighting(interaction, sampler));
 
-        float pdf = interaction.material->sample(interaction, sampler);
-        Vec3f BSDF = interaction.material->evaluate(interaction);
+        const BSDF &material = scene->getMaterial(interaction.material_id);
+        float pdf = material.sample(interaction, sampler);
+        if (pdf <= 0) break;
+        Vec3f f = material.evaluate(interaction);
         float cosine = interaction.wi.dot(interaction.normal.normalized());
-        beta = beta.cwiseProduct(BSDF * cosine / pdf);
+        beta = beta.cwiseProduct(f * cosine / pdf);
+        bsdf_pdf = material.isDelta() ? 0 : pdf;
+        if (!survive(i, beta, sampler)) break;
 
+        normal = interaction.normal;
         ray = Ray(interaction.pos, interaction.wi);
     }
     return L;
@@ -69,18 +280,61 @@ Vec3f Integrator::radiance(Ray &ray, Sampler &sampler) const {
 Vec3f Integrator::directLighting(Interaction &interaction, Sampler &sampler) const {
     Vec3f L(0, 0, 0);
     // Compute direct lighting.
+    Ray shadow_ray(interaction.pos, interaction.normal);
+    Vec3f contribution;
+    if (sampleLight(interaction, sampler, shadow_ray, contribution) && !scene->occluded(shadow_ray)) {
+        L = contribution;
+    }
+    return L;
+}
 
-    if (!interaction.material->isDelta()) {
-        std::shared_ptr<Light> light = scene->getLight();
-        float pdf = light->pdf(interaction, Vec3f(0, 0, 0));
-        std::shared_ptr<BSDF> material = interaction.material;
-        Vec3f light_sample = light->sample(interaction, nullptr, sampler);
-        Ray shadow_ray(interaction.pos, (light_sample - interaction.pos).normalized());
-        if (!scene->isShadowed(shadow_ray)) {
-            float cosine = shadow_ray.direction.dot(interaction.normal.normalized());
-            L = light->emission(Vec3f(), shadow_ray.direction).cwiseProduct(material->evaluate(interaction)) * cosine /
-                std::pow((light_sample - interaction.pos).norm(), 2) / pdf;
-        }
+bool Integrator::sampleLight(Interaction &interaction, Sampler &sampler, Ray &shadow_ray, Vec3f &contribution) const {
+    const BSDF &material = scene->getMaterial(interaction.material_id);
+    if (material.isDelta()) return false;
+    float select_pmf;
+    int light_id = scene->sampleLight(interaction.pos, interaction.normal, sampler.get1D(), select_pmf);
+    if (light_id == -1) return false;
+    const std::shared_ptr<Light> &light = scene->getLights()[light_id];
+    float light_pdf;
+    Vec3f light_sample = light->sample(interaction, &light_pdf, sampler);
+    if (light_pdf <= 0) return false;
+    light_pdf *= select_pmf;
+    // stop just short of the light so the emitter itself does not count as a blocker
+    float light_dist = (light_sample - interaction.pos).norm();
+    shadow_ray = Ray(interaction.pos, (light_sample - interaction.pos) / light_dist, RAY_DEFAULT_MIN,
+                     light_dist * (1 - EPS));
+    float cosine = shadow_ray.direction.dot(interaction.normal.normalized());
+    if (cosine <= 0) return false;
+    interaction.wi = shadow_ray.direction;
+    float weight = utils::powerHeuristic(light_pdf, material.pdf(interaction));
+    contribution = light->emission(light_sample, shadow_ray.direction).cwiseProduct(material.evaluate(interaction)) *
+                   cosine * weight / light_pdf;
+    return true;
+}
+
+Vec3f Integrator::emittedRadiance(const Ray &ray, int light_id, const Vec3f &pos, float bsdf_pdf,
+                                  const Vec3f &normal) const {
+    const std::shared_ptr<Light> &light = scene->getLights()[light_id];
+    Vec3f Le = light->emission(pos, ray.direction);
+    if (bsdf_pdf == 0) return Le;
+    float light_pdf = scene->lightPmf(ray.origin, normal, light_id) * light->pdf(ray.origin, pos);
+    return Le * utils::powerHeuristic(bsdf_pdf, light_pdf);
+}
+
+Vec3f Integrator::escapedRadiance(const Ray &ray, float bsdf_pdf, const Vec3f &normal) const {
+    Vec3f L(0, 0, 0);
+    // infinite lights only depend on the direction, any point along the ray stands for them
+    for (int light_id: scene->getInfiniteLights()) {
+        L += emittedRadiance(ray, light_id, ray.origin + ray.direction, bsdf_pdf, normal);
     }
     return L;
-}
\ No newline at end of file
+}
+
+bool Integrator::survive(int depth, Vec3f &beta, Sampler &sampler) const {
+    if (russian_roulette_depth <= 0 || depth + 1 < russian_roulette_depth) return true;
+    // dim paths are likely to stop, the floor keeps bright paths from running to max_depth for free
+    float q = std::max(0.05f, 1 - beta.maxCoeff());
+    if (sampler.get1D() < q) return false;
+    beta /= 1 - q;
+    return true;
+}
@@ -1,42 +1,262 @@
+#define STB_IMAGE_IMPLEMENTATION
+
 #include "light.h"
 
+#include <stb_image.h>
+#include <algorithm>
 #include <utility>
 #include <iostream>
 #include "utils.h"
+#include "sampler.h"
+
+namespace {
+    // largest float below 1
+    constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+    float safeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+
+    /// cos(max(0, a - b)) from the sines and cosines of the angles a and b
+    float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+        if (cos_a > cos_b) return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    /// sin(max(0, a - b)), see cosSubClamped
+    float sinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+        if (cos_a > cos_b) return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    /// continuous position in [0, n) drawn with u from the CDF of n piecewise constant bins
+    float sampleCdf(const float *cdf, int n, float u) {
+        // the bin with cdf[bin] <= u < cdf[bin + 1], bins of zero probability are never picked
+        int bin = std::clamp((int) (std::upper_bound(cdf, cdf + n + 1, u) - cdf) - 1, 0, n - 1);
+        float width = cdf[bin + 1] - cdf[bin];
+        float offset = width > 0 ? (u - cdf[bin]) / width : 0;
+        return (float) bin + std::min(offset, ONE_MINUS_EPSILON);
+    }
+
+    /// running sums of values[0, n) into cdf[0, n], normalized to end at 1. uniform when all are 0.
+    float buildCdf(const float *values, int n, float *cdf) {
+        cdf[0] = 0;
+        for (int i = 0; i < n; ++i) cdf[i + 1] = cdf[i] + values[i];
+        float total = cdf[n];
+        for (int i = 1; i <= n; ++i) cdf[i] = total > 0 ? cdf[i] / total : (float) i / (float) n;
+        return total;
+    }
+}
+
+LightBounds::LightBounds(AABB bounds, float phi, const Vec3f &w, float cos_theta_o, float cos_theta_e) :
+        bounds(std::move(bounds)), phi(phi), w(w), cos_theta_o(cos_theta_o), cos_theta_e(cos_theta_e) {}
+
+LightBounds::LightBounds(const LightBounds &a, const LightBounds &b) {
+    // groups that emit nothing do not widen the bounds
+    if (a.phi == 0 || b.phi == 0) {
+        *this = a.phi == 0 ? b : a;
+        return;
+    }
+    bounds = AABB(a.bounds, b.bounds);
+    phi = a.phi + b.phi;
+    cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    // smallest cone holding both normal cones
+    float theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0f, 1.0f));
+    float theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0f, 1.0f));
+    float theta_d = std::acos(std::clamp(a.w.dot(b.w), -1.0f, 1.0f));
+    if (std::min(theta_d + theta_b, PI) <= theta_a) {
+        w = a.w;
+        cos_theta_o = a.cos_theta_o;
+        return;
+    }
+    if (std::min(theta_d + theta_a, PI) <= theta_b) {
+        w = b.w;
+        cos_theta_o = b.cos_theta_o;
+        return;
+    }
+    float theta_o = (theta_a + theta_d + theta_b) / 2;
+    Vec3f axis = a.w.cross(b.w);
+    if (theta_o >= PI || axis.squaredNorm() == 0) {
+        w = a.w;
+        cos_theta_o = -1;
+        return;
+    }
+    // rotate a.w towards b.w until the cone touches the far side of a
+    w = Eigen::AngleAxisf(theta_o - theta_a, axis.normalized()) * a.w;
+    cos_theta_o = std::cos(theta_o);
+}
+
+float LightBounds::importance(const Vec3f &pos, const Vec3f &normal) const {
+    if (phi == 0) return 0;
+    Vec3f center = bounds.getCenter();
+    Vec3f to_pos = pos - center;
+    float radius2 = (bounds.upper_bnd - bounds.low_bnd).squaredNorm() / 4;
+    float dist2 = to_pos.squaredNorm();
+    // inside the sphere every direction may reach a light, only the distance bound is left
+    if (dist2 <= radius2) return phi / radius2;
+    Vec3f wi = to_pos.normalized();
+    // half angle of the cone of directions from pos to the bounding sphere
+    float cos_theta_b = safeSqrt(1 - radius2 / dist2);
+    float sin_theta_b = safeSqrt(1 - cos_theta_b * cos_theta_b);
+    // smallest angle between an emitter normal and the direction to pos
+    float cos_theta_w = w.dot(wi);
+    float sin_theta_w = safeSqrt(1 - cos_theta_w * cos_theta_w);
+    float sin_theta_o = safeSqrt(1 - cos_theta_o * cos_theta_o);
+    float cos_theta_x = cosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    float sin_theta_x = sinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    float cos_theta_p = cosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= cos_theta_e) return 0;
+    // smallest angle between the receiver normal and a direction to the group
+    float cos_theta_i = -normal.dot(wi);
+    float sin_theta_i = safeSqrt(1 - cos_theta_i * cos_theta_i);
+    float cos_theta_pi = cosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    return std::max(phi * cos_theta_p * cos_theta_pi / dist2, 0.0f);
+}
 
 Light::Light(Vec3f pos, Vec3f color) :
         position(std::move(pos)), radiance(std::move(color)) {}
 
 SquareAreaLight::SquareAreaLight(const Vec3f &pos, const Vec3f &color, const Vec2f &size) :
-        Light(pos, color), size(size) {
-    Vec3f v1, v2, v3, v4;
-    v1 = pos + Vec3f(size.x() / 2, 0.f, -size.y() / 2);
-    v2 = pos + Vec3f(-size.x() / 2, 0.f, -size.y() / 2);
-    v3 = pos + Vec3f(-size.x() / 2, 0.f, size.y() / 2);
-    v4 = pos + Vec3f(size.x() / 2, 0.f, size.y() / 2);
-    light_mesh = TriangleMesh({v1, v2, v3, v4}, {Vec3f(0, -1, 0)}, {0, 1, 2, 0, 2, 3}, {0, 0, 0, 0, 0, 0});
-}
+        Light(pos, color), size(size) {}
 
 Vec3f SquareAreaLight::emission(const Vec3f &pos, const Vec3f &dir) const {
+    // one sided, only the face towards (0,-1,0) emits
     float cosine = -dir.dot(Vec3f(0, -1, 0));
-    return radiance * std::max(cosine, 0.0f);
+    return cosine > 0 ? radiance : Vec3f(0, 0, 0);
 }
 
-float SquareAreaLight::pdf(const Interaction &interaction, Vec3f pos) {
-    return 1 / (size.x() * size.y());
+float SquareAreaLight::pdf(const Vec3f &ref, const Vec3f &pos) const {
+    Vec3f dir = pos - ref;
+    float dist2 = dir.squaredNorm();
+    float cosine = -dir.dot(Vec3f(0, -1, 0)) / std::sqrt(dist2);
+    if (cosine <= 0) return 0;
+    // uniform by area, converted to solid angle at ref
+    return dist2 / (cosine * size.x() * size.y());
 }
 
 Vec3f SquareAreaLight::sample(Interaction &interaction, float *pdf, Sampler &sampler) const {
     Vec2f coef = sampler.get2D();
     coef = coef * 2 - Vec2f(1, 1);
-    return position + coef.x() * Vec3f(1, 0, 0) * size.x() / 2 + coef.y() * Vec3f(0, 0, 1) * size.y() / 2;
+    Vec3f pos = position + coef.x() * Vec3f(1, 0, 0) * size.x() / 2 + coef.y() * Vec3f(0, 0, 1) * size.y() / 2;
+    if (pdf != nullptr) *pdf = this->pdf(interaction.pos, pos);
+    return pos;
+}
+
+LightBounds SquareAreaLight::getBounds() const {
+    Vec3f half(size.x() / 2, 0, size.y() / 2);
+    float phi = utils::luminance(radiance) * size.x() * size.y() * PI;
+    return {AABB(position - half, position + half), phi, Vec3f(0, -1, 0), 1, 0};
 }
 
-bool SquareAreaLight::intersect(Ray &ray, Interaction &interaction) const {
-    if (light_mesh.intersect(ray, interaction)) {
-        interaction.type = Interaction::Type::LIGHT;
-        return true;
+std::vector<Triangle> SquareAreaLight::getTriangles(int material_id) const {
+    Vec3f v1, v2, v3, v4;
+    v1 = position + Vec3f(size.x() / 2, 0.f, -size.y() / 2);
+    v2 = position + Vec3f(-size.x() / 2, 0.f, -size.y() / 2);
+    v3 = position + Vec3f(-size.x() / 2, 0.f, size.y() / 2);
+    v4 = position + Vec3f(size.x() / 2, 0.f, size.y() / 2);
+    Vec3f n(0, -1, 0);
+    return {Triangle(v1, v2, v3, n, n, n, material_id), Triangle(v1, v3, v4, n, n, n, material_id)};
+}
+
+TriangleLight::TriangleLight(const Triangle &triangle, const Vec3f &color) :
+        Light((triangle.getVertex(0) + triangle.getVertex(1) + triangle.getVertex(2)) / 3, color),
+        vertices{triangle.getVertex(0), triangle.getVertex(1), triangle.getVertex(2)} {
+    Vec3f cross = (vertices[1] - vertices[0]).cross(vertices[2] - vertices[0]);
+    area = cross.norm() / 2;
+    normal = cross.normalized();
+    if (normal.dot(triangle.getNormal(0) + triangle.getNormal(1) + triangle.getNormal(2)) < 0) normal = -normal;
+}
+
+Vec3f TriangleLight::emission(const Vec3f &pos, const Vec3f &dir) const {
+    return -dir.dot(normal) > 0 ? radiance : Vec3f(0, 0, 0);
+}
+
+float TriangleLight::pdf(const Vec3f &ref, const Vec3f &pos) const {
+    Vec3f dir = pos - ref;
+    float dist2 = dir.squaredNorm();
+    float cosine = -dir.dot(normal) / std::sqrt(dist2);
+    if (cosine <= 0 || area == 0) return 0;
+    return dist2 / (cosine * area);
+}
+
+Vec3f TriangleLight::sample(Interaction &interaction, float *pdf, Sampler &sampler) const {
+    // uniform by area: the square root warp folds the unit square onto the triangle
+    Vec2f u = sampler.get2D();
+    float su = std::sqrt(u.x());
+    Vec3f pos = (1 - su) * vertices[0] + su * (1 - u.y()) * vertices[1] + su * u.y() * vertices[2];
+    if (pdf != nullptr) *pdf = this->pdf(interaction.pos, pos);
+    return pos;
+}
+
+LightBounds TriangleLight::getBounds() const {
+    float phi = utils::luminance(radiance) * area * PI;
+    return {AABB(vertices[0], vertices[1], vertices[2]), phi, normal, 1, 0};
+}
+
+EnvironmentLight::EnvironmentLight(const std::string &hdr_file_path, float scale) {
+    int channels;
+    float *data = stbi_loadf(hdr_file_path.c_str(), &width, &height, &channels, 3);
+    if (data == nullptr) {
+        std::cerr << "can not load environment map " << hdr_file_path << ": " << stbi_failure_reason() << std::endl;
+        exit(-1);
     }
-    return false;
+    texels.resize(width * height);
+    weights.resize(width * height);
+    conditional_cdf.resize(height * (width + 1));
+    marginal_cdf.resize(height + 1);
+    std::vector<float> row_sums(height);
+#pragma omp parallel for default(none) shared(data, scale, row_sums)
+    for (int y = 0; y < height; ++y) {
+        // rows near the poles cover less solid angle
+        float sin_theta = std::sin(PI * ((float) y + 0.5f) / (float) height);
+        for (int x = 0; x < width; ++x) {
+            const float *texel = data + 3 * (y * width + x);
+            texels[y * width + x] = Vec3f(texel[0], texel[1], texel[2]) * scale;
+            weights[y * width + x] = std::max(utils::luminance(texels[y * width + x]), 0.0f) * sin_theta;
+        }
+        row_sums[y] = buildCdf(&weights[y * width], width, &conditional_cdf[y * (width + 1)]);
+    }
+    stbi_image_free(data);
+    weight_mean = buildCdf(row_sums.data(), height, marginal_cdf.data()) / (float) (width * height);
+}
+
+int EnvironmentLight::texelIndex(const Vec3f &dir) const {
+    Vec3f d = dir.normalized();
+    float u = std::atan2(d.z(), d.x()) / (2 * PI);
+    if (u < 0) u += 1;
+    float v = std::acos(std::clamp(d.y(), -1.0f, 1.0f)) / PI;
+    int x = std::min((int) (u * (float) width), width - 1), y = std::min((int) (v * (float) height), height - 1);
+    return y * width + x;
+}
+
+Vec3f EnvironmentLight::emission(const Vec3f &pos, const Vec3f &dir) const {
+    return texels[texelIndex(dir)];
+}
+
+float EnvironmentLight::pdf(const Vec3f &ref, const Vec3f &pos) const {
+    Vec3f dir = (pos - ref).normalized();
+    float sin_theta = std::sqrt(std::max(1 - dir.y() * dir.y(), 0.0f));
+    if (weight_mean <= 0 || sin_theta <= 0) return 0;
+    // density over the image, converted to solid angle by the area of the equirectangular mapping
+    return weights[texelIndex(dir)] / weight_mean / (2 * PI * PI * sin_theta);
+}
+
+Vec3f EnvironmentLight::sample(Interaction &interaction, float *pdf, Sampler &sampler) const {
+    Vec2f u = sampler.get2D();
+    // the row from the marginal CDF, then the column from the CDF of that row
+    float v = sampleCdf(marginal_cdf.data(), height, u.y());
+    int y = std::min((int) v, height - 1);
+    float x = sampleCdf(&conditional_cdf[y * (width + 1)], width, u.x());
+    float theta = PI * v / (float) height, phi = 2 * PI * x / (float) width;
+    Vec3f dir(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+    Vec3f pos = interaction.pos + dir * scene_diameter;
+    if (pdf != nullptr) *pdf = this->pdf(interaction.pos, pos);
+    return pos;
 }
 
+LightBounds EnvironmentLight::getBounds() const {
+    return {};
+}
+
+void EnvironmentLight::setSceneBounds(const AABB &bounds) {
+    // receivers lie within the bounds, an empty scene keeps a unit distance
+    scene_diameter = std::max((bounds.upper_bnd - bounds.low_bnd).norm(), 1.0f);
+}
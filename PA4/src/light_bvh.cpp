@@ -0,0 +1,114 @@
+#include "light_bvh.h"
+
+#include <algorithm>
+
+namespace {
+    // largest float below 1
+    constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+}
+
+void LightBVH::build(const std::vector<std::shared_ptr<Light>> &lights) {
+    // the builder works on the finite lights only, light_order maps its order back to light ids
+    std::vector<int> finite_lights;
+    for (int i = 0; i < (int) lights.size(); ++i) {
+        if (!lights[i]->isInfinite()) finite_lights.push_back(i);
+    }
+    int light_count = (int) finite_lights.size();
+    std::vector<LightBounds> bounds(light_count);
+    std::vector<AABB> prim_bounds(light_count);
+#pragma omp parallel for default(none) shared(light_count, lights, finite_lights, bounds, prim_bounds)
+    for (int i = 0; i < light_count; ++i) {
+        bounds[i] = lights[finite_lights[i]]->getBounds();
+        prim_bounds[i] = bounds[i].bounds;
+    }
+    nodes = buildBinnedSAHBVH(prim_bounds, light_order);
+    light_bounds.resize(light_count);
+    light_slots.assign(lights.size(), -1);
+    light_leaves.assign(lights.size(), -1);
+    for (int slot = 0; slot < light_count; ++slot) {
+        light_bounds[slot] = bounds[light_order[slot]];
+        light_order[slot] = finite_lights[light_order[slot]];
+        light_slots[light_order[slot]] = slot;
+    }
+    // children come after their parent, so a backward pass sees them first
+    node_bounds.resize(nodes.size());
+    parents.assign(nodes.size(), -1);
+    for (int idx = (int) nodes.size() - 1; idx >= 0; --idx) {
+        const LBVHNode &node = nodes[idx];
+        if (node.triangle_begin_idx != -1) {
+            LightBounds leaf_bounds;
+            for (int slot = node.triangle_begin_idx; slot <= node.triangle_end_idx; ++slot) {
+                leaf_bounds = LightBounds(leaf_bounds, light_bounds[slot]);
+                light_leaves[light_order[slot]] = idx;
+            }
+            node_bounds[idx] = leaf_bounds;
+        } else {
+            node_bounds[idx] = LightBounds(node_bounds[idx + 1], node_bounds[node.right_idx]);
+            parents[idx + 1] = parents[node.right_idx] = idx;
+        }
+    }
+}
+
+int LightBVH::sample(const Vec3f &pos, const Vec3f &normal, float u, float &pmf) const {
+    if (nodes.empty()) return -1;
+    pmf = 1;
+    int idx = 0;
+    while (nodes[idx].triangle_begin_idx == -1) {
+        int left = idx + 1, right = nodes[idx].right_idx;
+        float left_importance = node_bounds[left].importance(pos, normal);
+        float right_importance = node_bounds[right].importance(pos, normal);
+        if (left_importance + right_importance <= 0) return -1;
+        // u is rescaled to [0, 1) within the chosen branch and reused below it
+        float p_left = left_importance / (left_importance + right_importance);
+        if (u < p_left) {
+            u = std::min(u / p_left, ONE_MINUS_EPSILON);
+            pmf *= p_left;
+            idx = left;
+        } else {
+            u = std::min((u - p_left) / (1 - p_left), ONE_MINUS_EPSILON);
+            pmf *= 1 - p_left;
+            idx = right;
+        }
+    }
+    const LBVHNode &leaf = nodes[idx];
+    float importance[BVH_MAX_LEAF_SIZE];
+    float total = leafImportance(leaf, pos, normal, importance);
+    if (total <= 0) return -1;
+    int count = leaf.triangle_end_idx - leaf.triangle_begin_idx + 1, chosen = -1;
+    float target = u * total;
+    for (int i = 0; i < count; ++i) {
+        if (importance[i] <= 0) continue;
+        chosen = i;
+        if (target < importance[i]) break;
+        target -= importance[i];
+    }
+    pmf *= importance[chosen] / total;
+    return light_order[leaf.triangle_begin_idx + chosen];
+}
+
+float LightBVH::pmf(const Vec3f &pos, const Vec3f &normal, int light_id) const {
+    int idx = light_leaves[light_id];
+    float importance[BVH_MAX_LEAF_SIZE];
+    float total = leafImportance(nodes[idx], pos, normal, importance);
+    if (total <= 0) return 0;
+    float pmf = importance[light_slots[light_id] - nodes[idx].triangle_begin_idx] / total;
+    // the choices of sample from the leaf up, computed the same way to match its result
+    for (; idx != 0; idx = parents[idx]) {
+        int parent = parents[idx], left = parent + 1;
+        float left_importance = node_bounds[left].importance(pos, normal);
+        float right_importance = node_bounds[nodes[parent].right_idx].importance(pos, normal);
+        if (left_importance + right_importance <= 0) return 0;
+        float p_left = left_importance / (left_importance + right_importance);
+        pmf *= idx == left ? p_left : 1 - p_left;
+    }
+    return pmf;
+}
+
+float LightBVH::leafImportance(const LBVHNode &leaf, const Vec3f &pos, const Vec3f &normal, float *importance) const {
+    float total = 0;
+    for (int slot = leaf.triangle_begin_idx; slot <= leaf.triangle_end_idx; ++slot) {
+        importance[slot - leaf.triangle_begin_idx] = light_bounds[slot].importance(pos, normal);
+        total += importance[slot - leaf.triangle_begin_idx];
+    }
+    return total;
+}
@@ -1,72 +1,297 @@
 #include "load_obj.h"
+#include "binary_io.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-
-#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <limits>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+    // bytes of obj text per parallel task, a chunk ends at the first line break past its share
+    constexpr size_t OBJ_CHUNK_SIZE = 1 << 20;
+    // resolved index of an index 0, which obj files cannot refer to
+    constexpr long INVALID_INDEX = std::numeric_limits<long>::min();
 
-static bool loadObj(const std::string &path, std::vector<Vec3f> &vertices,
-                    std::vector<Vec3f> &normals, std::vector<int> &v_index, std::vector<int> &n_index) {
-    std::cout << "-- Loading model " << path << std::endl;
+    /// A run of whole lines of one file. Counted first, then parsed into the mesh at the offsets
+    /// given by the counts of the chunks before it.
+    struct ObjChunk {
+        ObjChunk(int file, const char *begin, const char *end) : file(file), begin(begin), end(end) {}
 
-    tinyobj::ObjReaderConfig readerConfig;
-    // readerConfig.mtl_search_path = "./";  // Path to material files
+        int file;
+        const char *begin;
+        const char *end;
+        size_t vertex_count{0};
+        size_t normal_count{0};
+        size_t triangle_count{0};
+        size_t vertex_offset{0};
+        size_t normal_offset{0};
+        size_t triangle_offset{0};
+        // first triangle of every quad, split along its shorter diagonal once all vertices are read
+        std::vector<size_t> quads;
+        // first line that failed to parse, nullptr if there is none
+        const char *error_line{nullptr};
+    };
 
-    tinyobj::ObjReader reader;
+    enum class LineType {
+        VERTEX, NORMAL, FACE, OTHER
+    };
 
-    if (!reader.ParseFromFile(path, readerConfig)) {
-        if (!reader.Error().empty()) {
-            std::cerr << "TinyObjReader: " << reader.Error();
+    inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    inline const char *skipSpace(const char *p, const char *end) {
+        while (p != end && isSpace(*p)) ++p;
+        return p;
+    }
+
+    /// the element declared by the line at p, which is moved past the keyword
+    LineType lineType(const char *&p, const char *end) {
+        p = skipSpace(p, end);
+        if (end - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+            p += 2;
+            return LineType::VERTEX;
         }
-        exit(1);
+        if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+            p += 3;
+            return LineType::NORMAL;
+        }
+        if (end - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+            p += 2;
+            return LineType::FACE;
+        }
+        return LineType::OTHER;
     }
 
-    if (!reader.Warning().empty()) {
-        std::cout << "TinyObjReader: " << reader.Warning();
+    /// number of vertices of the face whose vertex list starts at p
+    int faceVertexCount(const char *p, const char *end) {
+        int count = 0;
+        for (p = skipSpace(p, end); p != end && *p != '#'; p = skipSpace(p, end)) {
+            ++count;
+            while (p != end && !isSpace(*p)) ++p;
+        }
+        return count;
+    }
+
+    template<typename T>
+    bool parseNumber(const char *&p, const char *end, T &value) {
+        if (p != end && *p == '+') ++p;
+        auto [next, error] = std::from_chars(p, end, value);
+        if (error != std::errc()) return false;
+        p = next;
+        return true;
     }
 
-    auto &attrib = reader.GetAttrib();
-    auto &shapes = reader.GetShapes();
-    auto &materials = reader.GetMaterials();
+    bool parseVec3f(const char *&p, const char *end, Vec3f &value) {
+        for (int axis = 0; axis < 3; ++axis) {
+            p = skipSpace(p, end);
+            if (!parseNumber(p, end, value[axis])) return false;
+        }
+        return true;
+    }
+
+    /// Parse one vertex of a face, v, v/vt, v/vt/vn or v//vn. The indices are 1-based, or relative to
+    /// the end of what was declared so far when negative. A missing normal is 0.
+    bool parseFaceVertex(const char *&p, const char *end, long &v, long &vn) {
+        vn = 0;
+        if (!parseNumber(p, end, v)) return false;
+        if (p == end || *p != '/') return true;
+        ++p;
+        long vt;
+        if (p != end && *p != '/' && !parseNumber(p, end, vt)) return false;
+        if (p == end || *p != '/') return true;
+        ++p;
+        return parseNumber(p, end, vn);
+    }
+
+    /// 0-based index of an obj index, count elements are declared before it
+    inline long resolveIndex(long index, size_t count) {
+        if (index > 0) return index - 1;
+        return index < 0 ? (long) count + index : INVALID_INDEX;
+    }
 
-    for (size_t i = 0; i < attrib.vertices.size(); i += 3) {
-        vertices.emplace_back(attrib.vertices[i], attrib.vertices[i + 1],
-                              attrib.vertices[i + 2]);
+    /// the counts of the elements in the chunk
+    void countChunk(ObjChunk &chunk) {
+        for (const char *line = chunk.begin; line < chunk.end;) {
+            auto *line_end = static_cast<const char *>(std::memchr(line, '\n', chunk.end - line));
+            if (line_end == nullptr) line_end = chunk.end;
+            const char *p = line;
+            switch (lineType(p, line_end)) {
+                case LineType::VERTEX:
+                    ++chunk.vertex_count;
+                    break;
+                case LineType::NORMAL:
+                    ++chunk.normal_count;
+                    break;
+                case LineType::FACE:
+                    // faces with less than 3 vertices are skipped
+                    chunk.triangle_count += std::max(faceVertexCount(p, line_end) - 2, 0);
+                    break;
+                default:
+                    break;
+            }
+            line = line_end + 1;
+        }
     }
-    // for (size_t i = 0; i < attrib.texcoords.size(); i += 2) {
-    //   texCoords.push_back(vec2(attrib.texcoords[i], attrib.texcoords[i + 1]));
-    // }
-    for (size_t i = 0; i < attrib.normals.size(); i += 3) {
-        normals.emplace_back(attrib.normals[i], attrib.normals[i + 1], attrib.normals[i + 2]);
+
+    /// parse the chunk into mesh, which is sized for the whole file. stops at the first bad line.
+    void parseChunk(ObjChunk &chunk, ObjMesh &mesh) {
+        size_t vertex_id = chunk.vertex_offset, normal_id = chunk.normal_offset;
+        size_t triangle_id = chunk.triangle_offset;
+        std::vector<int> face_v, face_vn;
+        for (const char *line = chunk.begin; line < chunk.end;) {
+            auto *line_end = static_cast<const char *>(std::memchr(line, '\n', chunk.end - line));
+            if (line_end == nullptr) line_end = chunk.end;
+            const char *p = line;
+            bool valid = true;
+            switch (lineType(p, line_end)) {
+                case LineType::VERTEX:
+                    valid = parseVec3f(p, line_end, mesh.vertices[vertex_id++]);
+                    break;
+                case LineType::NORMAL:
+                    valid = parseVec3f(p, line_end, mesh.normals[normal_id++]);
+                    break;
+                case LineType::FACE: {
+                    face_v.clear();
+                    face_vn.clear();
+                    for (p = skipSpace(p, line_end); valid && p != line_end && *p != '#';
+                         p = skipSpace(p, line_end)) {
+                        long v = 0, vn = 0;
+                        valid = parseFaceVertex(p, line_end, v, vn) && (p == line_end || isSpace(*p));
+                        v = resolveIndex(v, vertex_id);
+                        vn = vn == 0 ? -1 : resolveIndex(vn, normal_id);
+                        valid &= v >= 0 && v < (long) mesh.vertices.size()
+                                 && vn >= -1 && vn < (long) mesh.normals.size();
+                        face_v.push_back((int) v);
+                        face_vn.push_back((int) vn);
+                    }
+                    if (!valid || face_v.size() < 3) break;
+                    if (face_v.size() == 4) chunk.quads.push_back(triangle_id);
+                    // a fan around the first vertex, quads are resplit later if needed
+                    for (int k = 1; k + 1 < (int) face_v.size(); ++k, ++triangle_id) {
+                        int corners[3] = {0, k, k + 1};
+                        for (int c = 0; c < 3; ++c) {
+                            mesh.v_index[3 * triangle_id + c] = face_v[corners[c]];
+                            mesh.n_index[3 * triangle_id + c] = face_vn[corners[c]];
+                        }
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            if (!valid) {
+                chunk.error_line = line;
+                return;
+            }
+            line = line_end + 1;
+        }
     }
-    // Loop over shapes
-    for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            auto fv = size_t(shapes[s].mesh.num_face_vertices[f]);
 
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                v_index.push_back(idx.vertex_index);
-                // tIndex.push_back(idx.texcoord_index);
-                n_index.push_back(idx.normal_index);
+    /// Split the quads of the chunk along their shorter diagonal, like tinyobjloader. They were
+    /// written as the triangles (0, 1, 2) and (0, 2, 3), the other split is (0, 1, 3) and (1, 2, 3).
+    void splitQuads(const ObjChunk &chunk, ObjMesh &mesh) {
+        for (size_t triangle_id: chunk.quads) {
+            int *v = &mesh.v_index[3 * triangle_id];
+            int *n = &mesh.n_index[3 * triangle_id];
+            int quad_v[4] = {v[0], v[1], v[2], v[5]}, quad_n[4] = {n[0], n[1], n[2], n[5]};
+            float diagonal02 = (mesh.vertices[quad_v[2]] - mesh.vertices[quad_v[0]]).squaredNorm();
+            float diagonal13 = (mesh.vertices[quad_v[3]] - mesh.vertices[quad_v[1]]).squaredNorm();
+            if (diagonal02 < diagonal13) continue;
+            int corners[6] = {0, 1, 3, 1, 2, 3};
+            for (int c = 0; c < 6; ++c) {
+                v[c] = quad_v[corners[c]];
+                n[c] = quad_n[corners[c]];
             }
-            index_offset += fv;
         }
     }
-    std::cout << "  # vertices: " << attrib.vertices.size() / 3 << std::endl;
-    std::cout << "  # faces: " << v_index.size() / 3 << std::endl;
-    return true;
+
+    /// peak resident set size of the process in bytes, 0 where it is not known
+    size_t peakResidentSize() {
+#ifdef _WIN32
+        return 0;
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return (size_t) usage.ru_maxrss;
+#else
+        return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+    }
 }
 
-std::shared_ptr<TriangleMesh> makeMeshObject(std::string path_to_obj, Vec3f translation, float scale) {
-    std::vector<Vec3f> vertices;
-    std::vector<Vec3f> normals;
-    std::vector<int> v_idx;
-    std::vector<int> n_idx;
-    loadObj(path_to_obj, vertices, normals, v_idx, n_idx);
-    for (auto &v: vertices) v = v * scale + translation;
-    return std::make_shared<TriangleMesh>(vertices, normals, v_idx, n_idx);
-}
\ No newline at end of file
+void loadObjFiles(const std::vector<std::string> &paths, std::vector<ObjMesh> &meshes) {
+    auto start = std::chrono::steady_clock::now();
+    int file_count = (int) paths.size();
+    std::vector<std::unique_ptr<MappedFile>> files(file_count);
+    std::vector<ObjChunk> chunks;
+    size_t total_size = 0;
+    for (int i = 0; i < file_count; ++i) {
+        std::cout << "-- Loading model " << paths[i] << std::endl;
+        files[i] = std::make_unique<MappedFile>(paths[i]);
+        if (!files[i]->isOpen()) {
+            std::cerr << "can not open obj file " << paths[i] << "!" << std::endl;
+            exit(1);
+        }
+        const char *data = files[i]->getData(), *end = data + files[i]->getSize();
+        total_size += files[i]->getSize();
+        for (const char *begin = data; begin < end;) {
+            const char *chunk_end = end;
+            if ((size_t) (end - begin) > OBJ_CHUNK_SIZE) {
+                auto *line_break = static_cast<const char *>(
+                        std::memchr(begin + OBJ_CHUNK_SIZE, '\n', end - begin - OBJ_CHUNK_SIZE));
+                if (line_break != nullptr) chunk_end = line_break + 1;
+            }
+            chunks.emplace_back(i, begin, chunk_end);
+            begin = chunk_end;
+        }
+    }
+    int chunk_count = (int) chunks.size();
+#pragma omp parallel for schedule(dynamic) default(none) shared(chunk_count, chunks)
+    for (int i = 0; i < chunk_count; ++i) countChunk(chunks[i]);
+    // chunks of a file are consecutive, their offsets are running sums over the file
+    meshes.assign(file_count, ObjMesh());
+    std::vector<size_t> vertex_count(file_count, 0), normal_count(file_count, 0), triangle_count(file_count, 0);
+    for (ObjChunk &chunk: chunks) {
+        chunk.vertex_offset = vertex_count[chunk.file];
+        chunk.normal_offset = normal_count[chunk.file];
+        chunk.triangle_offset = triangle_count[chunk.file];
+        vertex_count[chunk.file] += chunk.vertex_count;
+        normal_count[chunk.file] += chunk.normal_count;
+        triangle_count[chunk.file] += chunk.triangle_count;
+    }
+    for (int i = 0; i < file_count; ++i) {
+        meshes[i].vertices.resize(vertex_count[i]);
+        meshes[i].normals.resize(normal_count[i]);
+        meshes[i].v_index.resize(3 * triangle_count[i]);
+        meshes[i].n_index.resize(3 * triangle_count[i]);
+    }
+#pragma omp parallel for schedule(dynamic) default(none) shared(chunk_count, chunks, meshes)
+    for (int i = 0; i < chunk_count; ++i) parseChunk(chunks[i], meshes[chunks[i].file]);
+    for (const ObjChunk &chunk: chunks) {
+        if (chunk.error_line == nullptr) continue;
+        const char *line_end = chunk.error_line;
+        while (line_end != chunk.end && *line_end != '\n') ++line_end;
+        std::cerr << "invalid line in obj file " << paths[chunk.file] << ": "
+                  << std::string(chunk.error_line, line_end) << std::endl;
+        exit(1);
+    }
+#pragma omp parallel for schedule(dynamic) default(none) shared(chunk_count, chunks, meshes)
+    for (int i = 0; i < chunk_count; ++i) splitQuads(chunks[i], meshes[chunks[i].file]);
+    auto end = std::chrono::steady_clock::now();
+    for (int i = 0; i < file_count; ++i) {
+        std::cout << "  " << paths[i] << ": " << meshes[i].vertices.size() << " vertices, "
+                  << meshes[i].v_index.size() / 3 << " faces" << std::endl;
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Parsed " << file_count << " obj files (" << (double) total_size / 1e6 << "MB) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms, "
+              << (double) total_size / 1e6 / seconds << "MB/s, peak RSS "
+              << peakResidentSize() / (1024 * 1024) << "MB" << std::endl;
+}
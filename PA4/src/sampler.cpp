@@ -0,0 +1,165 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+    // largest float below 1
+    constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+    uint32_t reverseBits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    uint32_t hash(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    uint32_t hashCombine(uint32_t seed, uint32_t v) {
+        return seed ^ (hash(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+    }
+
+    /// Laine-Karras style permutation, every bit only depends on the bits below it
+    uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    /// Owen scrambling of a 0.32 fixed point value, bits are flipped depending on the bits above them
+    uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+    }
+
+    // the two dimensions of the Sobol (0,2)-sequence: van der Corput and the one from x + 1
+    uint32_t sobol0(uint32_t index) { return reverseBits(index); }
+
+    uint32_t sobol1(uint32_t index) {
+        uint32_t x = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1) x ^= v;
+        }
+        return x;
+    }
+
+    float toFloat(uint32_t x) {
+        return std::min((float) (x >> 8) * 0x1p-24f, ONE_MINUS_EPSILON);
+    }
+
+    /// splitmix64 finalizer
+    uint64_t mix64(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    const std::vector<int> &primes() {
+        static const std::vector<int> table = [] {
+            std::vector<int> result;
+            for (int n = 2; result.size() < 64; ++n) {
+                bool prime = true;
+                for (int p: result) prime &= n % p != 0;
+                if (prime) result.push_back(n);
+            }
+            return result;
+        }();
+        return table;
+    }
+}
+
+uint32_t Sampler::hashPixel() const {
+    return hashCombine(hashCombine(hash(pixel.x()), pixel.y()), frame);
+}
+
+uint64_t Sampler::hashSample() const {
+    return mix64((uint64_t) hashCombine(pixel_hash, 0) << 32 | (uint32_t) sample_index);
+}
+
+uint32_t Sampler::pixelSeed(int dim) const {
+    return hashCombine(pixel_hash, dim);
+}
+
+uint64_t IndependentSampler::next() {
+    // the splitmix64 stream of the pixel sample, evaluated at the dimension instead of stepped
+    return mix64(sample_hash + (uint64_t) (dimension++ + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+float IndependentSampler::get1D() {
+    return toFloat((uint32_t) (next() >> 32));
+}
+
+Vec2f IndependentSampler::get2D() {
+    uint64_t bits = next();
+    ++dimension;
+    // both values come from one 64-bit draw
+    return {toFloat((uint32_t) (bits >> 32)), toFloat((uint32_t) bits)};
+}
+
+float SobolSampler::get1D() {
+    uint32_t seed = pixelSeed(dimension++);
+    uint32_t index = nestedUniformScramble(sample_index, seed);
+    return toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+}
+
+Vec2f SobolSampler::get2D() {
+    uint32_t seed = pixelSeed(dimension);
+    dimension += 2;
+    uint32_t index = nestedUniformScramble(sample_index, seed);
+    return {toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0))),
+            toFloat(nestedUniformScramble(sobol1(index), hashCombine(seed, 1)))};
+}
+
+float HaltonSampler::get1D() {
+    return radicalInverse(dimension++);
+}
+
+Vec2f HaltonSampler::get2D() {
+    Vec2f result(radicalInverse(dimension), radicalInverse(dimension + 1));
+    dimension += 2;
+    return result;
+}
+
+float HaltonSampler::radicalInverse(int dim) const {
+    const std::vector<int> &bases = primes();
+    // dimensions past the table restart the bases with a different scrambling
+    uint64_t base = bases[dim % bases.size()];
+    uint32_t seed = pixelSeed(dim);
+    uint64_t index = sample_index, reversed = 0;
+    double inv_base_m = 1;
+    uint32_t level = 0;
+    for (; index != 0; ++level) {
+        uint64_t next = index / base;
+        uint64_t digit = index - next * base;
+        digit = (digit + hashCombine(hashCombine(seed, level), (uint32_t) reversed)) % base;
+        reversed = reversed * base + digit;
+        inv_base_m /= (double) base;
+        index = next;
+    }
+    // the digits past the index are zero, scrambled they are uniform within the stratum reached so far
+    double fill = (double) hashCombine(hashCombine(seed, level), (uint32_t) reversed) * 0x1p-32;
+    return std::min((float) (((double) reversed + fill) * inv_base_m), ONE_MINUS_EPSILON);
+}
+
+std::unique_ptr<Sampler> createSampler(SamplerType type, int frame) {
+    switch (type) {
+        case SamplerType::SOBOL:
+            return std::make_unique<SobolSampler>(frame);
+        case SamplerType::HALTON:
+            return std::make_unique<HaltonSampler>(frame);
+        default:
+            return std::make_unique<IndependentSampler>(frame);
+    }
+}
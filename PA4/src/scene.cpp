@@ -1,270 +1,398 @@
 #include "scene.h"
 #include "load_obj.h"
 #include "utils.h"
+#include "scene_cache.h"
 
 #include <utility>
 #include <iostream>
+#include <chrono>
+#include <filesystem>
 
-void Scene::addObject(std::shared_ptr<TriangleMesh> &mesh) {
-    objects.push_back(mesh);
-}
-
-void Scene::setLight(const std::shared_ptr<Light> &new_light) {
-    light = new_light;
-}
+#include <omp.h>
 
-bool Scene::isShadowed(Ray &shadow_ray) {
-    Interaction in;
-    return intersect(shadow_ray, in) && in.type == Interaction::Type::GEOMETRY;
-}
+Scene::Scene() : ray_counters(omp_get_max_threads()) {}
 
-bool Scene::intersect(Ray &ray, Interaction &interaction) {
-    light->intersect(ray, interaction);
-    if (!LBVH.empty()) {
-        auto *t_in = new float;
-        auto *t_out = new float;
-        bool hit = bvhNode->aabb.intersect(ray, t_in, t_out);
-        delete t_in;
-        delete t_out;
-        if (!hit) {
-            return false;
-        }
-        lbvhIntersect(0, interaction, ray);
-    } else {
-        for (const auto &obj: objects) {
-            Interaction cur_it;
-            if (obj->intersect(ray, cur_it) && (cur_it.dist < interaction.dist)) {
-                interaction = cur_it;
-            }
-        }
+void Scene::setLights(std::vector<std::shared_ptr<Light>> new_lights, std::vector<int> new_prim_lights) {
+    lights = std::move(new_lights);
+    prim_lights = std::move(new_prim_lights);
+    infinite_lights.clear();
+    for (int i = 0; i < (int) lights.size(); ++i) {
+        if (!lights[i]->isInfinite()) continue;
+        lights[i]->setSceneBounds(getBounds());
+        infinite_lights.push_back(i);
     }
-    return interaction.type != Interaction::Type::NONE;
-}
-
-const std::shared_ptr<Light> &Scene::getLight() const {
-    return light;
+    light_bvh = LightBVH();
+    light_bvh.build(lights);
 }
 
-BVHNode *Scene::getBVHNode() {
-    return bvhNode;
+const std::vector<int> &Scene::getInfiniteLights() const {
+    return infinite_lights;
 }
 
-BVHNode *Scene::buildBVH(int start, int end) {
-    if (end - start <= 8) {
-        AABB new_aabb = Triangles[start].getAABB();
-        for (int i = start + 1; i <= end; ++i) {
-            new_aabb = AABB(new_aabb, Triangles[i].getAABB());
-        }
-        return new BVHNode{.left=nullptr, .right=nullptr,
-                .aabb=new_aabb,
-                .triangles_begin_idx=start,
-                .triangles_end_idx=end};
+int Scene::sampleLight(const Vec3f &pos, const Vec3f &normal, float u, float &pmf) const {
+    int choices = (int) infinite_lights.size() + !light_bvh.empty();
+    if (choices == 0) return -1;
+    int choice = std::min((int) (u * (float) choices), choices - 1);
+    if (choice < (int) infinite_lights.size()) {
+        pmf = 1.0f / (float) choices;
+        return infinite_lights[choice];
     }
-    int split = findSplit(start, end);
-    BVHNode *left = buildBVH(start, split);
-    BVHNode *right = buildBVH(split + 1, end);
-    return new BVHNode{.left=left, .right=right, .aabb=AABB(left->aabb, right->aabb)};
+    int light_id = light_bvh.sample(pos, normal, u * (float) choices - (float) choice, pmf);
+    pmf /= (float) choices;
+    return light_id;
 }
 
-int Scene::findSplit(int start, int end) {
-    unsigned int startCode = Triangles[start].getMortonCode();
-    unsigned int endCode = Triangles[end].getMortonCode();
-
-    if (startCode == endCode) {
-        return (start + end) / 2;
-    }
-
-    int commonPrefix = __builtin_clz(startCode ^ endCode);
-
-    int split = start;
-    int step = end - start;
-
-    do {
-        step = (step + 1) >> 1;
-        int newSplit = split + step;
-        if (newSplit < end) {
-            unsigned int splitCode = Triangles[newSplit].getMortonCode();
-            int splitPrefix = __builtin_clz(startCode ^ splitCode);
-            if (splitPrefix > commonPrefix) {
-                split = newSplit;
-            }
-        }
-    } while (step > 1);
-    return split;
+float Scene::lightPmf(const Vec3f &pos, const Vec3f &normal, int light_id) const {
+    float choices = (float) infinite_lights.size() + !light_bvh.empty();
+    if (lights[light_id]->isInfinite()) return 1 / choices;
+    return light_bvh.pmf(pos, normal, light_id) / choices;
 }
 
-void Scene::setBVHRoot(BVHNode *root) {
-    bvhNode = root;
+void Scene::fillHit(const Ray &ray, const HitRecord &hit, Interaction &interaction) const {
+    const Instance &instance = instances[hit.instance_id];
+    const TriangleStore &triangles = meshes[instance.blas_id].getTriangles();
+    triangles.fillInteraction(ray, hit, interaction);
+    if (!instance.identity) interaction.normal = instance.normalToWorld(interaction.normal);
+    interaction.material_id = instance.material_id != -1 ? instance.material_id : triangles.getMaterialId(hit.prim_id);
+    int light_id = instance.light_offset == -1 ? -1 : prim_lights[instance.light_offset + hit.prim_id];
+    if (light_id != -1) {
+        interaction.type = Interaction::Type::LIGHT;
+        interaction.light_id = light_id;
+    }
 }
 
-void Scene::bvhIntersect(BVHNode *root, Interaction &interaction, Ray &ray) {
-    if (!root->left && !root->right) {
-        for (int i = root->triangles_begin_idx; i <= root->triangles_end_idx; ++i) {
-            Interaction curr_it;
-            if (Triangles[i].intersect(ray, curr_it) && curr_it.dist < interaction.dist) {
-                interaction = curr_it;
+void Scene::intersectPacket(Ray *rays, Interaction *interactions) {
+    ray_counters[omp_get_thread_num()].count += PACKET_SIZE;
+    if (TLAS.empty()) return;
+    float t_max[PACKET_SIZE];
+    for (int i = 0; i < PACKET_SIZE; ++i) t_max[i] = rays[i].t_max;
+    RayPacket packet(rays, t_max);
+    if (packet.coherent) {
+        intersectPacketBVH(TLAS, packet, [this, &packet](int begin, int end, uint64_t active) {
+            for (int instance_id = begin; instance_id <= end; ++instance_id) {
+                intersectPacketInstance(packet, instance_id, active);
             }
-        }
-        return;
-    } else if (!root->left || !root->right) {
-        BVHNode *child = root->left ? root->left : root->right;
-        Interaction curr_it;
-        bvhIntersect(child, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
-        }
-        return;
-    }
-    auto *left_min = new float, *left_max = new float, *right_min = new float, *right_max = new float;
-    bool left_hit = root->left->aabb.intersect(ray, left_min, left_max);
-    bool right_hit = root->right->aabb.intersect(ray, right_min, right_max);
-    float l_min = *left_min, r_min = *right_min;
-    delete left_min;
-    delete left_max;
-    delete right_min;
-    delete right_max;
-    if (!left_hit && !right_hit) {
-        return;
-    } else if (left_hit && right_hit) {
-        BVHNode *child = l_min < r_min ? root->left : root->right;
-        float t_min = std::max(l_min, r_min);
-        Interaction curr_it;
-        bvhIntersect(child, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
-        }
-        if (curr_it.dist > t_min) {
-            child = (child == root->right) ? root->left : root->right;
-            bvhIntersect(child, curr_it, ray);
-            if (curr_it.dist < interaction.dist) {
-                interaction = curr_it;
-            }
-        }
+        });
     } else {
-        BVHNode *child = left_hit ? root->left : root->right;
-        Interaction curr_it;
-        bvhIntersect(child, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
+        for (int i = 0; i < PACKET_SIZE; ++i) {
+            HitRecord hit;
+            hit.t = t_max[i];
+            if (intersect(TraversalRay(rays[i]), hit)) {
+                packet.prim_id[i] = hit.prim_id;
+                packet.instance_id[i] = hit.instance_id;
+                packet.t_max[i] = hit.t;
+                packet.u[i] = hit.u;
+                packet.v[i] = hit.v;
+            }
         }
     }
+    for (int i = 0; i < PACKET_SIZE; ++i) {
+        if (packet.prim_id[i] == -1) continue;
+        HitRecord hit{packet.t_max[i], packet.prim_id[i], packet.u[i], packet.v[i], packet.instance_id[i]};
+        fillHit(rays[i], hit, interactions[i]);
+    }
 }
 
-void Scene::lbvhIntersect(int idx, Interaction &interaction, Ray &ray) {
-    int begin_idx = LBVH.at(idx).triangle_begin_idx;
-    int end_idx = LBVH.at(idx).triangle_end_idx;
-    int right_idx = LBVH.at(idx).right_idx;
-    int left_idx = idx + 1;
-//    leaf node
-    if (begin_idx != -1) {
-        for (int i = begin_idx; i <= end_idx; ++i) {
-            Interaction curr_it;
-            if (Triangles[i].intersect(ray, curr_it) && curr_it.dist < interaction.dist) {
-                interaction = curr_it;
-            }
+void Scene::intersectPacketInstance(RayPacket &packet, int instance_id, uint64_t active) const {
+    const Instance &instance = instances[instance_id];
+    const BLAS &blas = meshes[instance.blas_id];
+    if (instance.identity) {
+        // the rays whose closest hit got nearer hit the instance
+        float t_max[PACKET_SIZE];
+        std::copy(packet.t_max, packet.t_max + PACKET_SIZE, t_max);
+        blas.intersectPacket(packet, active);
+        for (int i = 0; i < PACKET_SIZE; ++i) {
+            if (packet.t_max[i] < t_max[i]) packet.instance_id[i] = instance_id;
         }
         return;
     }
-//    node with only left child
-    else if (right_idx == -1) {
-        Interaction curr_it;
-        lbvhIntersect(left_idx, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
+    RayPacket local(packet, instance.inv_linear, instance.inv_translation, active);
+    if (local.coherent) {
+        blas.intersectPacket(local, active);
+    } else {
+        // the transform separated the direction signs
+        for (uint64_t mask = active; mask != 0; mask &= mask - 1) {
+            int i = __builtin_ctzll(mask);
+            Ray ray(Vec3f(local.origin[0][i], local.origin[1][i], local.origin[2][i]),
+                    Vec3f(local.direction[0][i], local.direction[1][i], local.direction[2][i]), local.t_min);
+            HitRecord hit;
+            hit.t = local.t_max[i];
+            if (blas.intersect(TraversalRay(ray), hit)) {
+                local.prim_id[i] = hit.prim_id;
+                local.t_max[i] = hit.t;
+                local.u[i] = hit.u;
+                local.v[i] = hit.v;
+            }
         }
-        return;
     }
-//    node with only right child
-    else if (right_idx - idx == 1) {
-        Interaction curr_it;
-        lbvhIntersect(right_idx, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
-        }
-        return;
+    // hits found in the instance are closer than the ones recorded before
+    for (uint64_t mask = active; mask != 0; mask &= mask - 1) {
+        int i = __builtin_ctzll(mask);
+        if (local.prim_id[i] == -1) continue;
+        packet.prim_id[i] = local.prim_id[i];
+        packet.instance_id[i] = instance_id;
+        packet.t_max[i] = local.t_max[i];
+        packet.u[i] = local.u[i];
+        packet.v[i] = local.v[i];
     }
+}
 
-    auto *left_min = new float, *left_max = new float, *right_min = new float, *right_max = new float;
-    bool left_hit = LBVH[left_idx].aabb.intersect(ray, left_min, left_max);
-    bool right_hit = LBVH[right_idx].aabb.intersect(ray, right_min, right_max);
-    float l_min = *left_min, r_min = *right_min;
-    delete left_min;
-    delete left_max;
-    delete right_min;
-    delete right_max;
-    if (!left_hit && !right_hit) {
-        return;
-    } else if (left_hit && right_hit) {
-        int child_idx = l_min <= r_min ? left_idx : right_idx;
-        float t_min = std::max(l_min, r_min);
-        Interaction curr_it;
-        lbvhIntersect(child_idx, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
+bool Scene::occluded(const Ray &ray) const {
+    auto &counter = ray_counters[omp_get_thread_num()];
+    ++counter.count;
+    ++counter.occlusion_count;
+    TraversalRay traversal_ray(ray);
+    return occludedBVH(TLAS, traversal_ray, [this, &traversal_ray](int begin, int end) {
+        for (int instance_id = begin; instance_id <= end; ++instance_id) {
+            const Instance &instance = instances[instance_id];
+            if (instance.occluded(meshes[instance.blas_id], traversal_ray)) return true;
+        }
+        return false;
+    });
+}
+
+bool Scene::intersect(Ray &ray, Interaction &interaction) {
+    ++ray_counters[omp_get_thread_num()].count;
+    // a scene without geometry has an empty TLAS, which nothing hits
+    HitRecord hit;
+    hit.t = std::min(ray.t_max, interaction.dist);
+    if (intersect(TraversalRay(ray), hit)) fillHit(ray, hit, interaction);
+    return interaction.type != Interaction::Type::NONE;
+}
+
+bool Scene::intersect(const TraversalRay &ray, HitRecord &hit) const {
+    return intersectBVH(TLAS, ray, hit, [this, &ray](int begin, int end, HitRecord &leaf_hit) {
+        // visit the instances of the leaf nearest first, so hits in front cull the ones behind
+        struct Entry {
+            int instance_id;
+            float t_in;
+        };
+        Entry entries[BVH_MAX_LEAF_SIZE];
+        int entry_count = 0;
+        for (int instance_id = begin; instance_id <= end; ++instance_id) {
+            float t_in;
+            if (!instances[instance_id].bounds.intersect(ray, leaf_hit.t, t_in)) continue;
+            int j = entry_count++;
+            for (; j > 0 && entries[j - 1].t_in > t_in; --j) entries[j] = entries[j - 1];
+            entries[j] = {instance_id, t_in};
         }
-        if (curr_it.dist > t_min) {
-            child_idx = (l_min > r_min) ? left_idx : right_idx;
-            lbvhIntersect(child_idx, curr_it, ray);
-            if (curr_it.dist < interaction.dist) {
-                interaction = curr_it;
+        bool found = false;
+        for (int i = 0; i < entry_count && entries[i].t_in <= leaf_hit.t; ++i) {
+            const Instance &instance = instances[entries[i].instance_id];
+            if (meshes[instance.blas_id].intersect(instance.toObject(ray), leaf_hit)) {
+                leaf_hit.instance_id = entries[i].instance_id;
+                found = true;
             }
         }
+        return found;
+    });
+}
 
-    } else {
-        int child_idx = left_hit ? left_idx : right_idx;
-        Interaction curr_it;
-        lbvhIntersect(child_idx, curr_it, ray);
-        if (curr_it.dist < interaction.dist) {
-            interaction = curr_it;
-        }
-    }
+const std::vector<std::shared_ptr<Light>> &Scene::getLights() const {
+    return lights;
 }
 
-void Scene::setTriangles(std::vector<Triangle> new_Triangles) {
-    Triangles = std::move(new_Triangles);
+void Scene::setGeometry(std::vector<BLAS> new_meshes, std::vector<Instance> new_instances) {
+    meshes = std::move(new_meshes);
+    int instance_count = (int) new_instances.size();
+    std::vector<AABB> instance_bounds(instance_count);
+    for (int i = 0; i < instance_count; ++i) instance_bounds[i] = new_instances[i].bounds;
+    std::vector<int> instance_order;
+    TLAS = instance_count == 0 ? std::vector<LBVHNode>() : buildBinnedSAHBVH(instance_bounds, instance_order);
+    // leaf ranges index the instances directly
+    instances.clear();
+    instances.reserve(instance_count);
+    for (int i = 0; i < instance_count; ++i) instances.push_back(new_instances[instance_order[i]]);
 }
 
-void Scene::DFS(BVHNode *root) {
-    LBVH.emplace_back(root->aabb);
-    int root_idx = (int) LBVH.size() - 1;
+void Scene::setMaterials(std::vector<BSDF> new_materials) {
+    materials = std::move(new_materials);
+}
 
-    if (!root->left && !root->right) {
-        LBVH.at(root_idx).triangle_begin_idx = root->triangles_begin_idx;
-        LBVH.at(root_idx).triangle_end_idx = root->triangles_end_idx;
-        return;
-    }
-    if (root->left) DFS(root->left);
-    if (root->right) {
-        LBVH.at(root_idx).right_idx = (int) LBVH.size();
-        DFS(root->right);
-    }
+size_t Scene::getTriangleMemorySize() const {
+    size_t size = 0;
+    for (const BLAS &blas: meshes) size += blas.getTriangles().getMemorySize();
+    return size;
+}
+
+unsigned long long Scene::getRayCount() const {
+    unsigned long long total = 0;
+    for (const auto &counter: ray_counters) total += counter.count;
+    return total;
+}
+
+unsigned long long Scene::getOcclusionRayCount() const {
+    unsigned long long total = 0;
+    for (const auto &counter: ray_counters) total += counter.occlusion_count;
+    return total;
+}
 
+AABB Scene::getBounds() const {
+    return TLAS.empty() ? AABB() : TLAS[0].aabb;
 }
 
-std::vector<LBVHNode> Scene::getLBVH() const {
-    return LBVH;
+size_t Scene::getBVHMemorySize() const {
+    size_t size = TLAS.size() * sizeof(LBVHNode);
+    for (const BLAS &blas: meshes) size += blas.getBVHMemorySize();
+    return size;
 }
 
 
+namespace {
+    /// build the meshes, instances and emitters of the objects and square lights of config
+    void buildSceneGeometry(const Config &config, std::map<std::string, int> &mat_list, int emitter_material,
+                            SceneGeometry &geometry) {
+        // Meshes placed more than once are built into one BLAS per obj file, and every placement is an
+        // instance of it with its own material. All other geometry is merged in world space into a
+        // static BLAS, which traces like a single flat BVH.
+        std::map<std::string, int> placement_counts;
+        for (const auto &object: config.objects) {
+            placement_counts[object.obj_file_path] += std::max((int) object.instances.size(), 1);
+        }
+        std::vector<BLAS> &meshes = geometry.meshes;
+        std::vector<Instance> &instances = geometry.instances;
+        auto build_mesh = [&](const std::string &name, const std::vector<Triangle> &triangles,
+                              std::vector<int> &prim_order) {
+            auto build_start = std::chrono::steady_clock::now();
+            meshes.emplace_back();
+            meshes.back().build(triangles, config.accel_config, prim_order);
+            auto build_end = std::chrono::steady_clock::now();
+            std::cout << "Built BVH of " << name << " (" << triangles.size() << " triangles) in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(build_end - build_start).count()
+                      << "ms, " << meshes.back().getLBVH().size() << " nodes, SAH cost "
+                      << computeSAHCost(meshes.back().getLBVH()) << std::endl;
+        };
+        // every square light and every triangle of an emissive material is one light, the square lights
+        // come first. emitters are part of the scene geometry, prim_lights holds the light of every
+        // triangle of the emitting instances.
+        std::vector<int> &prim_lights = geometry.prim_lights;
+        auto add_triangle_light = [&](const Triangle &triangle, const Vec3f &radiance) {
+            geometry.light_triangles.push_back(triangle);
+            geometry.light_radiance.push_back(radiance);
+            return (int) (config.lights.size() + geometry.light_triangles.size()) - 1;
+        };
+        std::vector<Triangle> static_triangles;
+        // light of every static triangle, -1 for none
+        std::vector<int> static_lights;
+        for (int i = 0; i < (int) config.lights.size(); ++i) {
+            const auto &light_config = config.lights[i];
+            SquareAreaLight light(Vec3f(light_config.position), Vec3f(light_config.radiance),
+                                  Vec2f(light_config.size));
+            for (const Triangle &triangle: light.getTriangles(emitter_material)) {
+                static_triangles.push_back(triangle);
+                static_lights.push_back(i);
+            }
+        }
+        // every obj file is parsed once, all of them at the same time
+        std::vector<std::string> obj_paths;
+        std::map<std::string, int> obj_list;
+        for (const auto &object: config.objects) {
+            if (mat_list.count(object.material_name) == 0) {
+                std::cerr << "unknown material " << object.material_name << "!" << std::endl;
+                exit(-1);
+            }
+            if (obj_list.count(object.obj_file_path) != 0) continue;
+            obj_list[object.obj_file_path] = (int) obj_paths.size();
+            obj_paths.push_back(object.obj_file_path);
+        }
+        std::cout << "loading obj files..." << std::endl;
+        std::vector<ObjMesh> obj_meshes;
+        loadObjFiles(obj_paths, obj_meshes);
+        // BLAS of each instanced obj file, with its triangles in BVH order for the lights of emissive instances
+        std::map<std::string, int> mesh_list;
+        std::vector<std::vector<Triangle>> mesh_triangles;
+        for (auto &object: config.objects) {
+            int material_id = mat_list[object.material_name];
+            Vec3f emission(config.materials[material_id].emission);
+            bool instanced = placement_counts[object.obj_file_path] > 1;
+            std::vector<Triangle> triangles;
+            if (!instanced || mesh_list.count(object.obj_file_path) == 0) {
+                ObjMesh &obj_mesh = obj_meshes[obj_list[object.obj_file_path]];
+                const std::vector<Vec3f> &v = obj_mesh.vertices, &n = obj_mesh.normals;
+                const std::vector<int> &v_idx = obj_mesh.v_index, &n_idx = obj_mesh.n_index;
+                int triangle_count = (int) v_idx.size() / 3;
+                triangles.resize(triangle_count);
+                // indices were checked by the parser, vertices without a normal get the face normal
+#pragma omp parallel for default(none) shared(triangle_count, triangles, v, n, v_idx, n_idx, material_id)
+                for (int i = 0; i < triangle_count; ++i) {
+                    Vec3f p[3], normals[3];
+                    for (int k = 0; k < 3; ++k) p[k] = v[v_idx[3 * i + k]];
+                    Vec3f face_normal = (p[1] - p[0]).cross(p[2] - p[0]).normalized();
+                    for (int k = 0; k < 3; ++k) normals[k] = n_idx[3 * i + k] < 0 ? face_normal : n[n_idx[3 * i + k]];
+                    triangles[i] = Triangle(p[0], p[1], p[2], normals[0], normals[1], normals[2], material_id);
+                }
+                // the parsed file is not needed once its triangles are built
+                obj_mesh = ObjMesh();
+                if (instanced) {
+                    std::vector<int> prim_order;
+                    build_mesh(object.obj_file_path, triangles, prim_order);
+                    mesh_list[object.obj_file_path] = (int) meshes.size() - 1;
+                    mesh_triangles.emplace_back();
+                    for (int prim: prim_order) mesh_triangles.back().push_back(triangles[prim]);
+                }
+            }
+            // translate and scale of the object come first, then the transform of each instance
+            Mat3f object_linear = Mat3f::Identity() * object.scale;
+            Vec3f object_translation(object.translate);
+            std::vector<Config::TransformConfig> placements = object.instances;
+            if (placements.empty()) placements.emplace_back();
+            for (const auto &placement: placements) {
+                Mat3f linear;
+                Vec3f translation;
+                transformFromConfig(placement, linear, translation);
+                translation = linear * object_translation + translation;
+                linear = linear * object_linear;
+                if (!instanced) {
+                    for (const Triangle &triangle: triangles) {
+                        static_triangles.push_back(transformTriangle(triangle, linear, translation, material_id));
+                        static_lights.push_back(-1);
+                        if (emission.maxCoeff() <= 0) continue;
+                        static_lights.back() = add_triangle_light(static_triangles.back(), emission);
+                    }
+                    continue;
+                }
+                int blas_id = mesh_list[object.obj_file_path];
+                instances.emplace_back(blas_id, material_id, linear, translation, meshes[blas_id].getBounds());
+                if (emission.maxCoeff() <= 0) continue;
+                instances.back().light_offset = (int) prim_lights.size();
+                for (const Triangle &triangle: mesh_triangles[blas_id]) {
+                    prim_lights.push_back(add_triangle_light(instances.back().toWorld(triangle), emission));
+                }
+            }
+        }
+        mesh_triangles.clear();
+        if (!static_triangles.empty()) {
+            std::vector<int> prim_order;
+            build_mesh("static geometry", static_triangles, prim_order);
+            instances.emplace_back((int) meshes.size() - 1, -1, Mat3f::Identity(), Vec3f(0, 0, 0),
+                                   meshes.back().getBounds());
+            instances.back().light_offset = (int) prim_lights.size();
+            for (int prim: prim_order) prim_lights.push_back(static_lights[prim]);
+        }
+    }
+}
+
 void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene) {
-    // add square light to scene.
-    std::shared_ptr<Light> light = std::make_shared<SquareAreaLight>(Vec3f(config.light_config.position),
-                                                                     Vec3f(config.light_config.radiance),
-                                                                     Vec2f(config.light_config.size));
-    scene->setLight(light);
-    // init all materials.
-    std::map<std::string, std::shared_ptr<BSDF>> mat_list;
+    // init all materials. instances refer to them by their index in the material table.
+    std::vector<BSDF> materials;
+    std::map<std::string, int> mat_list;
     for (const auto &mat: config.materials) {
-        std::shared_ptr<BSDF> p_mat;
+        mat_list[mat.name] = (int) materials.size();
         switch (mat.type) {
             case MaterialType::DIFFUSE: {
-                p_mat = std::make_shared<IdealDiffusion>(Vec3f(mat.color));
-                mat_list[mat.name] = p_mat;
+                materials.emplace_back(IdealDiffusion(Vec3f(mat.color)));
                 break;
             }
             case MaterialType::SPECULAR: {
-                p_mat = std::make_shared<IdealSpecular>();
-                mat_list[mat.name] = p_mat;
+                materials.emplace_back(IdealSpecular());
+                break;
+            }
+            case MaterialType::GLOSSY: {
+                materials.emplace_back(Glossy(Vec3f(mat.color), mat.exponent));
+                break;
+            }
+            case MaterialType::DIELECTRIC: {
+                materials.emplace_back(Dielectric(Vec3f(mat.color), mat.ior));
                 break;
             }
             default: {
@@ -273,47 +401,87 @@ void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene) {
             }
         }
     }
-    // add mesh objects to scene. Translation and scaling are directly applied to vertex coordinates.
-    // then set corresponding material by name.
-    std::cout << "loading obj files..." << std::endl;
-    std::vector<Triangle> Triangles;
-    Vec3f lower_bnd{1e10, 1e10, 1e10}, upper_bnd{-1e10, -1e10, -1e10};
-    for (auto &object: config.objects) {
-        auto mesh_obj = makeMeshObject(object.obj_file_path, Vec3f(object.translate), object.scale);
-        std::vector<Vec3f> v = mesh_obj->getVertices(), n = mesh_obj->getNormals();
-        std::vector<int> v_idx = mesh_obj->getVIndex(), n_idx = mesh_obj->getNIndex();
-        for (int i = 0; i < v_idx.size(); i += 3) {
-            std::vector<Vec3f> Vertices{v.at(v_idx.at(i + 0)),
-                                        v.at(v_idx.at(i + 1)),
-                                        v.at(v_idx.at(i + 2))};
-            std::vector<Vec3f> Normals{n.at(n_idx.at(i + 0)),
-                                       n.at(n_idx.at(i + 1)),
-                                       n.at(n_idx.at(i + 2))};
-            AABB aabb(v.at(v_idx.at(i + 0)), v.at(v_idx.at(i + 1)), v.at(v_idx.at(i + 2)));
-            Triangle t(Vertices, Normals, aabb);
-            t.setMaterial(mat_list[object.material_name]);
-            Triangles.push_back(t);
-            lower_bnd = lower_bnd.cwiseMin(v.at(v_idx.at(i + 0)));
-            upper_bnd = upper_bnd.cwiseMax(v.at(v_idx.at(i + 0)));
-            lower_bnd = lower_bnd.cwiseMin(v.at(v_idx.at(i + 1)));
-            upper_bnd = upper_bnd.cwiseMax(v.at(v_idx.at(i + 1)));
-            lower_bnd = lower_bnd.cwiseMin(v.at(v_idx.at(i + 2)));
-            upper_bnd = upper_bnd.cwiseMax(v.at(v_idx.at(i + 2)));
+    // square lights do not reflect, their triangles get a black material of their own
+    int emitter_material = (int) materials.size();
+    materials.emplace_back(IdealDiffusion(Vec3f(0, 0, 0)));
+    scene->setMaterials(std::move(materials));
+    if (config.accel_config.width != 2 && config.accel_config.width != 4 && config.accel_config.width != 8) {
+        std::cerr << "unsupported BVH width " << config.accel_config.width << "!" << std::endl;
+        exit(-1);
+    }
+    if (config.accel_config.width == 2 && config.accel_config.compressed) {
+        std::cerr << "compressed BVH nodes need width 4 or 8!" << std::endl;
+        exit(-1);
+    }
+    SceneGeometry geometry;
+    std::string cache_path;
+    uint64_t cache_key = 0;
+    bool cached = false;
+    if (!config.accel_config.cache_dir.empty()) {
+        auto load_start = std::chrono::steady_clock::now();
+        cache_key = sceneCacheKey(config);
+        cache_path = sceneCachePath(config.accel_config.cache_dir, cache_key);
+        // the material table ends with the emitter material
+        cached = loadSceneCache(cache_path, cache_key, (int) config.lights.size(), emitter_material + 1, geometry);
+        auto load_end = std::chrono::steady_clock::now();
+        if (cached) {
+            std::cout << "Loaded scene cache " << cache_path << " in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(load_end - load_start).count()
+                      << "ms" << std::endl;
+        }
+    }
+    if (!cached) {
+        buildSceneGeometry(config, mat_list, emitter_material, geometry);
+        if (!cache_path.empty()) {
+            auto save_start = std::chrono::steady_clock::now();
+            if (saveSceneCache(cache_path, cache_key, geometry)) {
+                auto save_end = std::chrono::steady_clock::now();
+                std::cout << "Wrote scene cache " << cache_path << " ("
+                          << std::filesystem::file_size(cache_path) / 1024 << "KB) in "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(save_end - save_start).count()
+                          << "ms" << std::endl;
+            } else {
+                std::cerr << "could not write scene cache " << cache_path << std::endl;
+            }
         }
     }
-    for (auto &triangle: Triangles) {
-        Vec3f v0 = triangle.getVertices().at(0);
-        Vec3f v1 = triangle.getVertices().at(1);
-        Vec3f v2 = triangle.getVertices().at(2);
-        Vec3f v = (v0 + v1 + v2) / 3;
-        v = (v - lower_bnd).array() / (upper_bnd - lower_bnd).array();
-        triangle.setMortonCode(utils::morton3D(v));
+    std::vector<std::shared_ptr<Light>> lights;
+    for (const auto &light_config: config.lights) {
+        lights.push_back(std::make_shared<SquareAreaLight>(Vec3f(light_config.position),
+                                                           Vec3f(light_config.radiance), Vec2f(light_config.size)));
+    }
+    for (int i = 0; i < (int) geometry.light_triangles.size(); ++i) {
+        lights.push_back(std::make_shared<TriangleLight>(geometry.light_triangles[i], geometry.light_radiance[i]));
+    }
+    std::vector<BLAS> &meshes = geometry.meshes;
+    std::vector<Instance> &instances = geometry.instances;
+    std::vector<int> &prim_lights = geometry.prim_lights;
+    int mesh_count = (int) meshes.size(), instance_count = (int) instances.size();
+    auto tlas_start = std::chrono::steady_clock::now();
+    scene->setGeometry(std::move(meshes), std::move(instances));
+    auto tlas_end = std::chrono::steady_clock::now();
+    std::cout << "Built TLAS over " << instance_count << " instances of " << mesh_count << " meshes in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(tlas_end - tlas_start).count() << "ms"
+              << std::endl;
+    auto light_start = std::chrono::steady_clock::now();
+    if (!config.environment.hdr_file_path.empty()) {
+        auto environment = std::make_shared<EnvironmentLight>(config.environment.hdr_file_path,
+                                                              config.environment.scale);
+        Vec2i resolution = environment->getResolution();
+        std::cout << "Loaded environment map " << config.environment.hdr_file_path << ", "
+                  << resolution.x() << " x " << resolution.y() << std::endl;
+        lights.push_back(environment);
     }
-    std::sort(Triangles.begin(), Triangles.end(),
-              [=](const Triangle &a, const Triangle &b) { return a.getMortonCode() < b.getMortonCode(); });
-    scene->setTriangles(Triangles);
-    std::cout << "Building BVH" << std::endl;
-    scene->setBVHRoot(scene->buildBVH(0, (int) Triangles.size() - 1));
-    std::cout << "Finished building BVH" << std::endl;
-    scene->DFS(scene->getBVHNode());
-}
\ No newline at end of file
+    int light_count = (int) lights.size();
+    scene->setLights(std::move(lights), std::move(prim_lights));
+    auto light_end = std::chrono::steady_clock::now();
+    std::cout << "Built light BVH over " << light_count << " lights in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(light_end - light_start).count() << "ms"
+              << std::endl;
+    std::cout << "Packed triangles into " << scene->getTriangleMemorySize() / 1024 << "KB" << std::endl;
+    if (config.accel_config.width != 2) {
+        std::cout << "Collapsed BVHs to width " << config.accel_config.width
+                  << (config.accel_config.compressed ? " with quantized nodes" : "") << std::endl;
+    }
+    std::cout << "BVH node memory: " << scene->getBVHMemorySize() / 1024 << "KB" << std::endl;
+}
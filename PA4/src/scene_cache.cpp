@@ -0,0 +1,140 @@
+#include "scene_cache.h"
+#include "config_io.h"
+#include "binary_io.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <set>
+#include <utility>
+
+namespace {
+    // "PA4SCENE" read as a little endian integer
+    constexpr uint64_t SCENE_CACHE_MAGIC = 0x454e454353344150ull;
+    // bump whenever the layout of the file or of anything stored in it changes
+    constexpr uint32_t SCENE_CACHE_VERSION = 1;
+
+    /// 64-bit FNV-1a
+    uint64_t hashBytes(const std::string &bytes) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (char c: bytes) {
+            hash ^= (uint8_t) c;
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+uint64_t sceneCacheKey(const Config &config) {
+    Config::AccelConfig accel_config = config.accel_config;
+    accel_config.cache_dir.clear();
+    nlohmann::json j{{"version",     SCENE_CACHE_VERSION},
+                     {"block_size",  TRIANGLE_BLOCK_SIZE},
+                     {"objects",     config.objects},
+                     {"lights",      config.lights},
+                     {"accel",       accel_config}};
+    // the order of the materials gives the material ids, their emission the triangle lights
+    for (const auto &material: config.materials) {
+        j["materials"].push_back({material.name, material.emission});
+    }
+    std::set<std::string> paths;
+    for (const auto &object: config.objects) paths.insert(object.obj_file_path);
+    for (const auto &path: paths) {
+        // a missing file gives fixed error values, loading it fails later anyway
+        std::error_code error;
+        auto size = std::filesystem::file_size(path, error);
+        auto time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        j["files"].push_back({path, size, time});
+    }
+    return hashBytes(j.dump());
+}
+
+std::string sceneCachePath(const std::string &cache_dir, uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "scene_%016llx.bin", (unsigned long long) key);
+    return (std::filesystem::path(cache_dir) / name).string();
+}
+
+bool loadSceneCache(const std::string &path, uint64_t key, int square_light_count, int material_count,
+                    SceneGeometry &geometry) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    BinaryReader reader(file.getData(), file.getSize());
+    uint64_t magic, file_key;
+    uint32_t version;
+    if (!reader.read(magic) || !reader.read(version) || !reader.read(file_key)) return false;
+    if (magic != SCENE_CACHE_MAGIC || version != SCENE_CACHE_VERSION || file_key != key) return false;
+    uint64_t mesh_count;
+    if (!reader.read(mesh_count) || mesh_count > file.getSize()) return false;
+    // read into loaded, geometry is left as it is unless the whole file reads
+    SceneGeometry loaded;
+    loaded.meshes.resize(mesh_count);
+    for (BLAS &blas: loaded.meshes) {
+        if (!blas.read(reader, material_count)) return false;
+    }
+    uint64_t instance_count;
+    if (!reader.read(instance_count) || instance_count > file.getSize()) return false;
+    for (uint64_t i = 0; i < instance_count; ++i) {
+        int32_t blas_id, material_id, light_offset;
+        Mat3f linear;
+        Vec3f translation;
+        if (!reader.read(blas_id) || !reader.read(material_id) || !reader.read(light_offset)
+            || !reader.read(linear) || !reader.read(translation)) {
+            return false;
+        }
+        if (blas_id < 0 || blas_id >= (int) mesh_count) return false;
+        // -1 keeps the materials of the triangles
+        if (material_id < -1 || material_id >= material_count) return false;
+        loaded.instances.emplace_back(blas_id, material_id, linear, translation, loaded.meshes[blas_id].getBounds());
+        loaded.instances.back().light_offset = light_offset;
+    }
+    if (!reader.readArray(loaded.light_triangles) || !reader.readArray(loaded.light_radiance)
+        || !reader.readArray(loaded.prim_lights) || loaded.light_triangles.size() != loaded.light_radiance.size()) {
+        return false;
+    }
+    // the lights of all triangles of an instance have to lie in prim_lights, and name existing lights
+    for (const Instance &instance: loaded.instances) {
+        if (instance.light_offset == -1) continue;
+        size_t triangle_count = loaded.meshes[instance.blas_id].getTriangles().size();
+        if (instance.light_offset < 0 || instance.light_offset + triangle_count > loaded.prim_lights.size()) {
+            return false;
+        }
+    }
+    int light_count = square_light_count + (int) loaded.light_triangles.size();
+    for (int light: loaded.prim_lights) {
+        if (light < -1 || light >= light_count) return false;
+    }
+    geometry = std::move(loaded);
+    return true;
+}
+
+bool saveSceneCache(const std::string &path, uint64_t key, const SceneGeometry &geometry) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    // written next to the cache and renamed over it, so readers never see a partial file
+    std::string temp_path = path + ".tmp";
+    {
+        BinaryWriter writer(temp_path);
+        writer.write(SCENE_CACHE_MAGIC);
+        writer.write(SCENE_CACHE_VERSION);
+        writer.write(key);
+        writer.write<uint64_t>(geometry.meshes.size());
+        for (const BLAS &blas: geometry.meshes) blas.write(writer);
+        writer.write<uint64_t>(geometry.instances.size());
+        for (const Instance &instance: geometry.instances) {
+            writer.write<int32_t>(instance.blas_id);
+            writer.write<int32_t>(instance.material_id);
+            writer.write<int32_t>(instance.light_offset);
+            writer.write(instance.linear);
+            writer.write(instance.translation);
+        }
+        writer.writeArray(geometry.light_triangles);
+        writer.writeArray(geometry.light_radiance);
+        writer.writeArray(geometry.prim_lights);
+        if (!writer.good()) {
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp_path, path, error);
+    return !error;
+}
@@ -0,0 +1,53 @@
+#include "triangle_store.h"
+#include "binary_io.h"
+
+void TriangleStore::build(const std::vector<Triangle> &triangles) {
+    int triangle_count = (int) triangles.size();
+    int block_count = (triangle_count + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE;
+    blocks.assign(block_count, TriangleBlock<TRIANGLE_BLOCK_SIZE>{});
+    normals.resize(3 * triangle_count);
+    material_ids.resize(triangle_count);
+#pragma omp parallel for default(none) shared(triangle_count, triangles)
+    for (int prim_id = 0; prim_id < triangle_count; ++prim_id) {
+        const Triangle &triangle = triangles[prim_id];
+        auto &block = blocks[prim_id / TRIANGLE_BLOCK_SIZE];
+        int lane = prim_id % TRIANGLE_BLOCK_SIZE;
+        Vec3f edge1 = triangle.getVertex(1) - triangle.getVertex(0);
+        Vec3f edge2 = triangle.getVertex(2) - triangle.getVertex(0);
+        for (int axis = 0; axis < 3; ++axis) {
+            block.v0[axis][lane] = triangle.getVertex(0)[axis];
+            block.edge1[axis][lane] = edge1[axis];
+            block.edge2[axis][lane] = edge2[axis];
+        }
+        for (int k = 0; k < 3; ++k) normals[3 * prim_id + k] = triangle.getNormal(k);
+        material_ids[prim_id] = triangle.getMaterialId();
+    }
+}
+
+void TriangleStore::fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const {
+    const Vec3f *n = &normals[3 * hit.prim_id];
+    interaction.dist = hit.t;
+    interaction.pos = ray(hit.t);
+    interaction.normal = (hit.u * n[1] + hit.v * n[2] + (1 - hit.u - hit.v) * n[0]).normalized();
+    interaction.type = Interaction::Type::GEOMETRY;
+}
+
+size_t TriangleStore::getMemorySize() const {
+    return blocks.size() * sizeof(TriangleBlock<TRIANGLE_BLOCK_SIZE>)
+           + normals.size() * sizeof(Vec3f) + material_ids.size() * sizeof(int);
+}
+
+void TriangleStore::write(BinaryWriter &writer) const {
+    writer.writeArray(blocks);
+    writer.writeArray(normals);
+    writer.writeArray(material_ids);
+}
+
+bool TriangleStore::read(BinaryReader &reader, int material_count) {
+    if (!reader.readArray(blocks) || !reader.readArray(normals) || !reader.readArray(material_ids)) return false;
+    for (int material_id: material_ids) {
+        if (material_id < 0 || material_id >= material_count) return false;
+    }
+    return normals.size() == 3 * material_ids.size()
+           && blocks.size() == (material_ids.size() + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE;
+}
@@ -0,0 +1,262 @@
+#include "wavefront_integrator.h"
+#include "utils.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace {
+    /// indices of the set flags in [0, flags.size()), in order. Each thread compacts one contiguous
+    /// chunk and writes it behind the survivors of the chunks before it.
+    void compactSlots(const std::vector<char> &flags, std::vector<int> &slots) {
+        int n = (int) flags.size();
+        std::vector<int> offsets(omp_get_max_threads() + 1, 0);
+#pragma omp parallel default(none) shared(flags, slots, offsets, n)
+        {
+            int thread = omp_get_thread_num(), thread_count = omp_get_num_threads();
+            int begin = (int) ((long long) n * thread / thread_count);
+            int end = (int) ((long long) n * (thread + 1) / thread_count);
+            offsets[thread + 1] = (int) std::count(flags.begin() + begin, flags.begin() + end, 1);
+#pragma omp barrier
+#pragma omp single
+            {
+                for (int i = 0; i < thread_count; ++i) offsets[i + 1] += offsets[i];
+                slots.resize(offsets[thread_count]);
+            }
+            int out = offsets[thread];
+            for (int i = begin; i < end; ++i) {
+                if (flags[i]) slots[out++] = i;
+            }
+        }
+    }
+}
+
+void WavefrontIntegrator::PathQueue::resize(int n) {
+    origin.resize(n);
+    direction.resize(n);
+    beta.resize(n);
+    bsdf_pdf.resize(n);
+    normal.resize(n);
+    path_id.resize(n);
+    dimension.resize(n);
+    hit.resize(n);
+}
+
+void WavefrontIntegrator::ShadowQueue::resize(int n) {
+    origin.resize(n);
+    direction.resize(n);
+    t_max.resize(n);
+    contribution.resize(n);
+}
+
+WavefrontIntegrator::WavefrontIntegrator(std::shared_ptr<Camera> cam,
+                                         std::shared_ptr<Scene> scene, int spp, int max_depth,
+                                         const Config::RenderConfig &render_config)
+        : Integrator(std::move(cam), std::move(scene), spp, max_depth, render_config),
+          wavefront_size(std::max(render_config.wavefront_size, 1)),
+          sort_rays(render_config.sort_rays),
+          group_materials(render_config.group_materials) {
+}
+
+void WavefrontIntegrator::render() const {
+    Vec2i resolution = camera->getImage()->getResolution();
+    int pixel_count = resolution.x() * resolution.y();
+    int num_sample = (int) std::sqrt(spp);
+    int samples_per_pixel = num_sample * num_sample;
+    // a wave holds all samples of a range of pixels
+    int pixels_per_wave = std::max(wavefront_size / samples_per_pixel, 1);
+    std::vector<std::unique_ptr<Sampler>> samplers(omp_get_max_threads());
+    for (auto &sampler: samplers) sampler = createSampler(sampler_type, frame);
+
+    PathQueue paths, next_paths;
+    ShadowQueue shadows;
+    std::vector<char> has_shadow, alive;
+    std::vector<int> shade_slots, shadow_slots, alive_slots;
+    std::vector<Vec3f> path_radiance;
+    for (int first_pixel = 0; first_pixel < pixel_count; first_pixel += pixels_per_wave) {
+        int wave_pixels = std::min(pixels_per_wave, pixel_count - first_pixel);
+        paths.resize(wave_pixels * samples_per_pixel);
+        path_radiance.assign(paths.size(), Vec3f(0, 0, 0));
+        generateCameraRays(first_pixel, samples_per_pixel, samplers, paths);
+        for (int depth = 0; depth < max_depth && paths.size() > 0; ++depth) {
+            intersect(paths);
+            shadows.resize(paths.size());
+            has_shadow.assign(paths.size(), 0);
+            alive.assign(paths.size(), 0);
+            if (group_materials) {
+                groupByMaterial(paths, shade_slots);
+            } else {
+                shade_slots.resize(paths.size());
+                std::iota(shade_slots.begin(), shade_slots.end(), 0);
+            }
+            shade(paths, shade_slots, depth, first_pixel, samplers, shadows, has_shadow, alive, path_radiance);
+            compactSlots(has_shadow, shadow_slots);
+            traceShadowRays(paths, shadows, shadow_slots, path_radiance);
+            // move the paths that continue to the front of the next queue
+            compactSlots(alive, alive_slots);
+            if (sort_rays) sortSlots(paths, alive_slots);
+            int alive_count = (int) alive_slots.size();
+            next_paths.resize(alive_count);
+#pragma omp parallel for default(none) shared(paths, next_paths, alive_slots, alive_count)
+            for (int i = 0; i < alive_count; ++i) {
+                int slot = alive_slots[i];
+                next_paths.origin[i] = paths.origin[slot];
+                next_paths.direction[i] = paths.direction[slot];
+                next_paths.beta[i] = paths.beta[slot];
+                next_paths.bsdf_pdf[i] = paths.bsdf_pdf[slot];
+                next_paths.normal[i] = paths.normal[slot];
+                next_paths.path_id[i] = paths.path_id[slot];
+                next_paths.dimension[i] = paths.dimension[slot];
+            }
+            std::swap(paths, next_paths);
+        }
+        // the samples of a pixel are consecutive paths
+#pragma omp parallel for default(none) shared(first_pixel, wave_pixels, samples_per_pixel, path_radiance, resolution)
+        for (int i = 0; i < wave_pixels; ++i) {
+            Vec3f L(0, 0, 0);
+            for (int s = 0; s < samples_per_pixel; ++s) L += path_radiance[i * samples_per_pixel + s];
+            int pixel = first_pixel + i;
+            camera->getImage()->setPixel(pixel % resolution.x(), pixel / resolution.x(),
+                                         L / (float) samples_per_pixel);
+        }
+        printf("\r%.02f%%", (first_pixel + wave_pixels) * 100.0 / pixel_count);
+    }
+}
+
+void WavefrontIntegrator::generateCameraRays(int first_pixel, int samples_per_pixel,
+                                             std::vector<std::unique_ptr<Sampler>> &samplers, PathQueue &paths) const {
+    Vec2i resolution = camera->getImage()->getResolution();
+    int num_sample = (int) std::sqrt(samples_per_pixel);
+#pragma omp parallel for default(none) shared(first_pixel, samples_per_pixel, samplers, paths, resolution, num_sample)
+    for (int path = 0; path < paths.size(); ++path) {
+        Sampler &sampler = *samplers[omp_get_thread_num()];
+        int pixel = first_pixel + path / samples_per_pixel, sample = path % samples_per_pixel;
+        int i = sample / num_sample, j = sample % num_sample;
+        Vec2i pixel_pos(pixel % resolution.x(), pixel / resolution.x());
+        // same pixel positions as Integrator::renderTile
+        sampler.startPixelSample(pixel_pos, sample);
+        Vec2f offset = sampler.get2D();
+        if (sampler_type == SamplerType::INDEPENDENT) offset = (Vec2f((float) i, (float) j) + offset) / (float) num_sample;
+        Ray ray = camera->generateRay((float) pixel_pos.x() + offset.x(), (float) pixel_pos.y() + offset.y());
+        paths.origin[path] = ray.origin;
+        paths.direction[path] = ray.direction;
+        paths.beta[path] = Vec3f(1, 1, 1);
+        paths.bsdf_pdf[path] = 0;
+        paths.normal[path] = Vec3f(0, 0, 0);
+        paths.path_id[path] = path;
+        paths.dimension[path] = sampler.getDimension();
+    }
+}
+
+void WavefrontIntegrator::sortSlots(const PathQueue &paths, std::vector<int> &slots) const {
+    AABB bounds = scene->getBounds();
+    Vec3f extent = (bounds.upper_bnd - bounds.low_bnd).cwiseMax(Vec3f::Constant(EPS));
+    int slot_count = (int) slots.size();
+    std::vector<unsigned int> keys(slot_count);
+#pragma omp parallel for default(none) shared(paths, slots, keys, bounds, extent, slot_count)
+    for (int i = 0; i < slot_count; ++i) {
+        const Vec3f &direction = paths.direction[slots[i]];
+        unsigned int octant = (direction.x() < 0) | (direction.y() < 0) << 1 | (direction.z() < 0) << 2;
+        // 7 bits per axis of the origin below the octant, the key fits the three passes of a 24 bit sort
+        unsigned int morton = utils::morton3D((paths.origin[slots[i]] - bounds.low_bnd).cwiseQuotient(extent));
+        keys[i] = octant << 21 | morton >> 9;
+    }
+    radixSortPairs(keys, slots, 24);
+}
+
+void WavefrontIntegrator::intersect(PathQueue &paths) const {
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(paths)
+    for (int slot = 0; slot < paths.size(); ++slot) {
+        Ray ray(paths.origin[slot], paths.direction[slot]);
+        paths.hit[slot] = Interaction{};
+        scene->intersect(ray, paths.hit[slot]);
+    }
+}
+
+void WavefrontIntegrator::groupByMaterial(const PathQueue &paths, std::vector<int> &slots) const {
+    // counting sort on the group of every slot, group 0 holds the hits without a BSDF
+    std::vector<int> offsets(BSDF::TYPE_COUNT + 2, 0);
+    std::vector<int> groups(paths.size());
+    for (int slot = 0; slot < paths.size(); ++slot) {
+        const Interaction &interaction = paths.hit[slot];
+        groups[slot] = interaction.type == Interaction::Type::GEOMETRY
+                       ? 1 + scene->getMaterial(interaction.material_id).getType() : 0;
+        ++offsets[groups[slot] + 1];
+    }
+    for (int group = 0; group <= BSDF::TYPE_COUNT; ++group) offsets[group + 1] += offsets[group];
+    slots.resize(paths.size());
+    for (int slot = 0; slot < paths.size(); ++slot) slots[offsets[groups[slot]]++] = slot;
+}
+
+void WavefrontIntegrator::shade(PathQueue &paths, const std::vector<int> &slots, int depth, int first_pixel,
+                                std::vector<std::unique_ptr<Sampler>> &samplers, ShadowQueue &shadows,
+                                std::vector<char> &has_shadow, std::vector<char> &alive,
+                                std::vector<Vec3f> &path_radiance) const {
+    int resolution_x = camera->getImage()->getResolution().x();
+    int num_sample = (int) std::sqrt(spp);
+    int samples_per_pixel = num_sample * num_sample;
+    int slot_count = (int) slots.size();
+#pragma omp parallel for schedule(dynamic, 64) default(none) \
+        shared(paths, slots, slot_count, depth, first_pixel, samplers, shadows, has_shadow, alive, path_radiance, \
+               resolution_x, samples_per_pixel)
+    for (int i = 0; i < slot_count; ++i) {
+        int slot = slots[i];
+        Interaction &interaction = paths.hit[slot];
+        if (interaction.type == Interaction::Type::NONE) {
+            Ray ray(paths.origin[slot], paths.direction[slot]);
+            path_radiance[paths.path_id[slot]] +=
+                    paths.beta[slot].cwiseProduct(escapedRadiance(ray, paths.bsdf_pdf[slot], paths.normal[slot]));
+            continue;
+        }
+        // the path continues its pixel sample where the last bounce left off
+        Sampler &sampler = *samplers[omp_get_thread_num()];
+        int pixel = first_pixel + paths.path_id[slot] / samples_per_pixel;
+        sampler.startPixelSample(Vec2i(pixel % resolution_x, pixel / resolution_x),
+                                 paths.path_id[slot] % samples_per_pixel, paths.dimension[slot]);
+        interaction.wo = paths.direction[slot];
+        if (interaction.type == Interaction::Type::LIGHT) {
+            Ray ray(paths.origin[slot], paths.direction[slot]);
+            Vec3f Le = emittedRadiance(ray, interaction.light_id, interaction.pos, paths.bsdf_pdf[slot],
+                                       paths.normal[slot]);
+            path_radiance[paths.path_id[slot]] += paths.beta[slot].cwiseProduct(Le);
+            continue;
+        }
+        const Vec3f &beta = paths.beta[slot];
+        Ray shadow_ray(interaction.pos, interaction.normal);
+        Vec3f contribution;
+        if (sampleLight(interaction, sampler, shadow_ray, contribution)) {
+            shadows.origin[slot] = shadow_ray.origin;
+            shadows.direction[slot] = shadow_ray.direction;
+            shadows.t_max[slot] = shadow_ray.t_max;
+            shadows.contribution[slot] = beta.cwiseProduct(contribution);
+            has_shadow[slot] = 1;
+        }
+
+        const BSDF &material = scene->getMaterial(interaction.material_id);
+        float pdf = material.sample(interaction, sampler);
+        if (pdf <= 0) continue;
+        Vec3f f = material.evaluate(interaction);
+        float cosine = interaction.wi.dot(interaction.normal.normalized());
+        paths.beta[slot] = beta.cwiseProduct(f * cosine / pdf);
+        paths.bsdf_pdf[slot] = material.isDelta() ? 0 : pdf;
+        if (!survive(depth, paths.beta[slot], sampler)) continue;
+        paths.dimension[slot] = sampler.getDimension();
+        paths.normal[slot] = interaction.normal;
+        paths.origin[slot] = interaction.pos;
+        paths.direction[slot] = interaction.wi;
+        alive[slot] = 1;
+    }
+}
+
+void WavefrontIntegrator::traceShadowRays(const PathQueue &paths, const ShadowQueue &shadows,
+                                          const std::vector<int> &slots, std::vector<Vec3f> &path_radiance) const {
+    int shadow_count = (int) slots.size();
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(paths, shadows, slots, path_radiance, shadow_count)
+    for (int i = 0; i < shadow_count; ++i) {
+        int slot = slots[i];
+        Ray shadow_ray(shadows.origin[slot], shadows.direction[slot], RAY_DEFAULT_MIN, shadows.t_max[slot]);
+        if (!scene->occluded(shadow_ray)) path_radiance[paths.path_id[slot]] += shadows.contribution[slot];
+    }
+}
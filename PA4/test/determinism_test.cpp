@@ -0,0 +1,139 @@
+// Renders a small scene with 1, 4 and the default number of threads and checks that every image is
+// bit-identical: samples only depend on pixel, sample index and frame, never on the thread that
+// takes them. The path and wavefront integrators are also checked to agree on the mean of the image.
+#include "integrator.h"
+#include "wavefront_integrator.h"
+#include "config_io.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <omp.h>
+
+namespace {
+    const char *SCENE_OBJ = R"(v -1 0 -1
+v 1 0 -1
+v 1 0 1
+v -1 0 1
+v -0.3 0 -0.3
+v 0.3 0 -0.3
+v 0.3 0.6 -0.3
+v -0.3 0.6 -0.3
+v -0.3 0 0.3
+v 0.3 0 0.3
+v 0.3 0.6 0.3
+v -0.3 0.6 0.3
+f 1 4 3 2
+f 5 8 7 6
+f 9 10 11 12
+f 5 9 12 8
+f 6 7 11 10
+f 8 12 11 7
+)";
+
+    const char *SCENE_CONFIG = R"({
+        "spp": 16,
+        "max_depth": 5,
+        "image_resolution": [40, 24],
+        "cam_config": {"position": [0, 1, 3], "look_at": [0, 0.3, 0], "ref_up": [0, 1, 0],
+                       "vertical_fov": 45, "focal_length": 1},
+        "light_config": {"position": [0, 1.5, 0], "size": [0.5, 0.5], "radiance": [8, 8, 8]},
+        "materials": [{"color": [0.7, 0.7, 0.7], "type": "diffuse", "name": "grey"},
+                      {"color": [0.8, 0.5, 0.3], "type": "glossy", "name": "copper", "exponent": 16},
+                      {"color": [0.9, 0.9, 1.0], "type": "dielectric", "name": "glass"}],
+        "objects": [{"obj_file_path": "", "material_name": "grey"},
+                    {"obj_file_path": "", "material_name": "copper", "instances": [{"translate": [-0.6, 0, 0]}]},
+                    {"obj_file_path": "", "material_name": "glass",
+                     "instances": [{"translate": [0.6, 0, 0], "rotate": [0, 30, 0], "scale": [0.7, 1, 0.7]}]}]
+    })";
+
+    /// variations of the render settings, each is checked on its own
+    const char *RENDER_CONFIGS[] = {
+            R"({"sampler": "independent", "tile_size": 8})",
+            R"({"sampler": "sobol", "packet_tracing": true, "russian_roulette_depth": 2})",
+            R"({"sampler": "halton", "pass_spp": 4, "target_error": 0.05, "max_spp": 32, "tile_order": "hilbert"})",
+            R"({"integrator": "wavefront", "sampler": "sobol", "wavefront_size": 256, "sort_rays": true,
+                "group_materials": true})"};
+
+    /// spp that is not a square, both integrators round it down to a square number of samples
+    constexpr int NON_SQUARE_SPP = 32;
+    /// relative difference allowed between the image means of the two integrators
+    constexpr float MEAN_TOLERANCE = 0.05f;
+
+    float imageMean(const std::vector<Vec3f> &image) {
+        double sum = 0;
+        for (const Vec3f &value: image) sum += value.sum();
+        return (float) (sum / (3.0 * (double) image.size()));
+    }
+
+    std::vector<Vec3f> render(const Config &config, int threads) {
+        omp_set_num_threads(threads);
+        auto image = std::make_shared<ImageRGB>(config.image_resolution[0], config.image_resolution[1]);
+        auto camera = std::make_shared<Camera>(config.cam_config, image);
+        auto scene = std::make_shared<Scene>();
+        initSceneFromConfig(config, scene);
+        std::unique_ptr<Integrator> integrator;
+        if (config.render_config.integrator == IntegratorType::WAVEFRONT) {
+            integrator = std::make_unique<WavefrontIntegrator>(camera, scene, config.spp, config.max_depth,
+                                                               config.render_config);
+        } else {
+            integrator = std::make_unique<Integrator>(camera, scene, config.spp, config.max_depth,
+                                                      config.render_config);
+        }
+        integrator->render();
+        return image->getData();
+    }
+}
+
+int main() {
+    if (!simdTargetSupported()) return 77;
+    std::filesystem::path obj_path = std::filesystem::temp_directory_path() / "determinism_test_scene.obj";
+    std::ofstream(obj_path) << SCENE_OBJ;
+    nlohmann::json scene_json = nlohmann::json::parse(SCENE_CONFIG);
+    for (auto &object: scene_json["objects"]) object["obj_file_path"] = obj_path.string();
+    int max_threads = omp_get_max_threads();
+    bool passed = true;
+    for (const char *render_config: RENDER_CONFIGS) {
+        nlohmann::json j = scene_json;
+        j["render_config"] = nlohmann::json::parse(render_config);
+        Config config;
+        nlohmann::from_json(j, config);
+        std::vector<Vec3f> reference = render(config, 1);
+        // a black image would match trivially
+        if (!(imageMean(reference) > 0)) {
+            std::cerr << "\nblack image, render_config " << render_config << std::endl;
+            passed = false;
+        }
+        for (int threads: {4, max_threads}) {
+            std::vector<Vec3f> image = render(config, threads);
+            if (std::memcmp(image.data(), reference.data(), reference.size() * sizeof(Vec3f)) != 0) {
+                std::cerr << "\nimage rendered with " << threads << " threads differs from 1 thread, render_config "
+                          << render_config << std::endl;
+                passed = false;
+            }
+        }
+    }
+    // independent samples of the same scene, so the means only differ by noise
+    float means[2];
+    const char *integrators[2] = {"path", "wavefront"};
+    for (int k = 0; k < 2; ++k) {
+        nlohmann::json j = scene_json;
+        j["spp"] = NON_SQUARE_SPP;
+        j["render_config"] = {{"integrator", integrators[k]}};
+        Config config;
+        nlohmann::from_json(j, config);
+        means[k] = imageMean(render(config, max_threads));
+    }
+    if (!(std::abs(means[1] - means[0]) <= MEAN_TOLERANCE * means[0])) {
+        std::cerr << "\nmean of the wavefront image " << means[1] << " differs from the path integrator's "
+                  << means[0] << " at spp " << NON_SQUARE_SPP << std::endl;
+        passed = false;
+    }
+    std::filesystem::remove(obj_path);
+    omp_set_num_threads(max_threads);
+    std::cout << (passed ? "\nall renders match" : "\nrenders differ") << std::endl;
+    return passed ? 0 : 1;
+}